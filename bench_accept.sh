@@ -0,0 +1,69 @@
+#!/bin/sh
+# Сравнение моделей приёма соединений сервера (--accept reuseport и exclusive)
+# в двух сценариях: churn — короткие соединения с частотой CHURN в секунду,
+# skew — несколько тяжёлых долгоживущих соединений на фоне лёгких. Для каждого
+# прогона печатает доли потоков в принятых соединениях и запросах (наибольшую
+# и наименьшую), разброс процессорного времени потоков и p99 клиента.
+#
+#   ./bench_accept.sh                        # 4 потока, по 10 секунд на прогон
+#   WORKERS=8 DURATION=30 CHURN=20000 ./bench_accept.sh
+set -u
+
+WORKERS=${WORKERS:-4}
+DURATION=${DURATION:-10}
+CHURN=${CHURN:-3000}
+PORT=${PORT:-5000}
+CXX=${CXX:-g++}
+SRC=$(cd "$(dirname "$0")" && pwd)
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+$CXX -std=c++17 -O2 -pthread "$SRC/tcp_server.cpp" -o "$OUT/server" || exit 1
+$CXX -std=c++17 -O2 -pthread "$SRC/tcp_client.cpp" -o "$OUT/client" || exit 1
+
+# p99 задержки запроса из сводки клиента, в микросекундах
+client_p99() {
+    sed -n 's/^Request latency.* p99=\([0-9.]*\) .*/\1/p' "$1"
+}
+
+# Наибольшая и наименьшая доля потоков в принятых соединениях и запросах,
+# наименьшее и наибольшее процессорное время потока
+worker_spread() {
+    awk '/^Worker [0-9]+: accepted=/ {
+        a = $4; gsub(/[()%]/, "", a); r = $6; gsub(/[()%]/, "", r)
+        c = $8; sub(/cpu=/, "", c); sub(/s$/, "", c)
+        if (n == 0 || a > amax) amax = a; if (n == 0 || a < amin) amin = a
+        if (n == 0 || r > rmax) rmax = r; if (n == 0 || r < rmin) rmin = r
+        if (n == 0 || c > cmax) cmax = c; if (n == 0 || c < cmin) cmin = c
+        n++
+    } END {
+        printf "accepted %5.1f..%5.1f%%  requests %5.1f..%5.1f%%  cpu %.2f..%.2fs", amin, amax, rmin, rmax, cmin, cmax
+    }' "$1"
+}
+
+run() {
+    mode=$1 scenario=$2
+    "$OUT/server" --workers "$WORKERS" --accept "$mode" --quiet "$PORT" > "$OUT/server.txt" 2>&1 &
+    server=$!
+    sleep 0.5
+    if [ "$scenario" = churn ]; then
+        "$OUT/client" --churn-rate "$CHURN" --duration "$DURATION" --quiet 10 500 127.0.0.1 "$PORT" \
+            > "$OUT/client.txt" 2>&1
+    else
+        "$OUT/client" --duration "$DURATION" --quiet 10000 8 127.0.0.1 "$PORT" > "$OUT/heavy.txt" 2>&1 &
+        heavy=$!
+        "$OUT/client" --duration "$DURATION" --quiet 10 400 127.0.0.1 "$PORT" > "$OUT/client.txt" 2>&1
+        wait "$heavy"
+    fi
+    kill -INT "$server"
+    wait "$server"
+    printf "%-9s %-5s %s  p99 %sus\n" "$mode" "$scenario" "$(worker_spread "$OUT/server.txt")" \
+        "$(client_p99 "$OUT/client.txt")"
+}
+
+echo "workers=$WORKERS duration=${DURATION}s churn=${CHURN}/s, CPUs: $(nproc)"
+for scenario in churn skew; do
+    for mode in reuseport exclusive; do
+        run "$mode" "$scenario"
+    done
+done
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Проверка бюджета выделений памяти на пути запроса: собирает сервер с
+# -DALLOC_TRACKING и клиента, даёт нагрузку (с делениями на ноль, чтобы
+# проверялся и ответ ERR) и завершается с кодом 1, если какой-либо рабочий
+# поток сервера выделял больше BUDGET раз на запрос или клиент не получил
+# верных ответов.
+#
+#   ./check_alloc_budget.sh                  # бюджет 0, 10 секунд нагрузки
+#   BUDGET=0.01 DURATION=30 ./check_alloc_budget.sh
+set -u
+
+BUDGET=${BUDGET:-0}
+DURATION=${DURATION:-10}
+PORT=${PORT:-5000}
+WORKERS=${WORKERS:-2}
+CXX=${CXX:-g++}
+SRC=$(cd "$(dirname "$0")" && pwd)
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+$CXX -std=c++17 -O2 -pthread -DALLOC_TRACKING "$SRC/tcp_server.cpp" -o "$OUT/server_alloc" || exit 1
+$CXX -std=c++17 -O2 -pthread "$SRC/tcp_client.cpp" -o "$OUT/client" || exit 1
+
+"$OUT/server_alloc" --workers "$WORKERS" --quiet --alloc-budget "$BUDGET" "$PORT" &
+SERVER=$!
+sleep 0.5
+
+"$OUT/client" --duration "$DURATION" --quiet --zero-div 0.1 10 100 127.0.0.1 "$PORT"
+CLIENT_RC=$?
+
+kill -INT "$SERVER"
+wait "$SERVER"
+SERVER_RC=$?
+
+if [ "$SERVER_RC" -ne 0 ]; then
+    echo "FAIL: allocation budget $BUDGET per request exceeded (server exit code $SERVER_RC)"
+    exit 1
+fi
+if [ "$CLIENT_RC" -ne 0 ]; then
+    echo "FAIL: client exit code $CLIENT_RC"
+    exit 1
+fi
+echo "OK: allocations within the budget of $BUDGET per request"
@@ -2,25 +2,57 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <linux/net_tstamp.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <climits>
 #include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
 #include <random>
 #include <sstream>
-#include <stack>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 constexpr int MAX_EVENTS = 1000; // Максимальное количество событий для epoll
 
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
 // Устанавливает неблокирующий режим для файлового дескриптора
 int set_nonblocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
@@ -28,233 +60,4273 @@ int set_nonblocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-// Возвращает приоритет оператора
-int precedence(char op) {
-    if (op == '+' || op == '-') return 1;
-    if (op == '*' || op == '/') return 2;
-    return 0;
+// Генератор случайных чисел, инициализированный 64-битным seed
+std::mt19937 make_rng(uint64_t seed) {
+    std::seed_seq seq{uint32_t(seed), uint32_t(seed >> 32)};
+    return std::mt19937(seq);
+}
+
+// Перемешивание 64-битного значения (финализатор splitmix64)
+uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
 }
 
-// Применяет оператор op к значениям a и b
-long apply_op(long a, long b, char op) {
-    switch (op) {
-        case '+': return a + b;
-        case '-': return a - b;
-        case '*': return a * b;
-        case '/':
-            return b == 0 ? 0 : a / b;  // в клиенте на деление на ноль — 0
+// Быстрый ГПСЧ xoshiro256**: генерация выражений упирается в память, а не в mt19937
+class FastRng {
+public:
+    explicit FastRng(uint64_t seed) {
+        // Состояние раскладывается из seed через splitmix64
+        for (uint64_t& x : s_) {
+            seed += 0x9e3779b97f4a7c15ull;
+            x = mix64(seed);
+        }
+    }
+
+    uint64_t next() {
+        uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return result;
+    }
+
+    // Равномерное число из [0, range) умножением со сдвигом (метод Лемира)
+    uint32_t below(uint32_t range) {
+        return uint32_t(((next() >> 32) * range) >> 32);
     }
-    throw std::runtime_error("Unknown operator");
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+    uint64_t s_[4];
+};
+
+// Смещения внутри сообщений 32-битные, поэтому выражение не длиннее 4 ГБ
+constexpr int MAX_TERMS = 1400000000;
+
+// Максимальная длина выражения из n чисел: до двух цифр и оператор на число
+size_t max_expression_length(int n) {
+    return size_t(n) * 3;
 }
 
-// Локальное вычисление выражения (shunting‑yard)
-long evaluate(const std::string& s) {
-    std::stack<long> values;  // стек для чисел
-    std::stack<char> ops;     // стек для операторов
+// Деление на число 1..10: ветвь с константой компилятор заменяет умножением
+inline long divide_small(long a, long v) {
+    switch (v) {
+        case 1: return a;
+        case 2: return a / 2;
+        case 3: return a / 3;
+        case 4: return a / 4;
+        case 5: return a / 5;
+        case 6: return a / 6;
+        case 7: return a / 7;
+        case 8: return a / 8;
+        case 9: return a / 9;
+        default: return a / v;
+    }
+}
 
-    for (size_t i = 0; i < s.size(); ) {
-        if (std::isspace(static_cast<unsigned char>(s[i]))) {
-            ++i;
+// Однопроходный генератор: пишет выражение из n чисел прямо в out и попутно
+// вычисляет его значение. * и / связываются сильнее + и -, все операторы
+// левоассоциативны, поэтому выражение — это сумма слагаемых со знаками, а каждое
+// слагаемое — цепочка умножений и делений. Достаточно хранить сумму завершённых
+// слагаемых и текущее слагаемое, чтобы получить тот же результат, что и сервер,
+// без повторного разбора строки. Длинные цепочки умножений переполняют 64 бита:
+// сервер считает +, - и * по модулю 2^64, поэтому и здесь арифметика
+// беззнаковая. out должен вмещать max_expression_length(n) байт.
+// Возвращает длину выражения.
+size_t generate_expression(int n, FastRng& rng, char* out, long& expected) {
+    static const char ops[4] = {'+', '-', '*', '/'};
+    char* p = out;
+    uint64_t sum = 0;   // сумма завершённых слагаемых
+    uint64_t term = 0;  // текущее слагаемое
+    uint64_t sign = 1;  // знак, с которым текущее слагаемое войдёт в сумму
+    char mul_op = 0;    // оператор между текущим слагаемым и следующим числом
+    for (int i = 0; i < n; ++i) {
+        // Один вызов ГПСЧ на число: старшие биты — число, младшие — оператор
+        uint64_t r = rng.next();
+        uint64_t v = 1 + (((r >> 32) * 10) >> 32); // числа от 1 до 10
+        if (v == 10) {
+            *p++ = '1';
+            *p++ = '0';
+        } else {
+            *p++ = char('0' + v);
         }
-        else if (std::isdigit(static_cast<unsigned char>(s[i]))) {
-            // читаем целое число
-            long val = 0;
-            while (i < s.size() && std::isdigit(static_cast<unsigned char>(s[i]))) {
-                val = val * 10 + (s[i++] - '0');
+        if (mul_op == '*') term *= v;
+        else if (mul_op == '/') term = uint64_t(divide_small(long(term), long(v))); // деление знаковое, как у сервера
+        else term = v;
+
+        if (i + 1 < n) {
+            char op = ops[r & 3];
+            *p++ = op;
+            if (op == '*' || op == '/') {
+                mul_op = op;
+            } else {
+                sum += sign * term;
+                sign = op == '+' ? 1 : uint64_t(-1);
+                mul_op = 0;
             }
-            values.push(val);
         }
-        else {
-            // текущий символ — оператор
-            char op = s[i++];
-            // пока в стеке ops есть оператор с приоритетом >= текущего
-            while (!ops.empty() && precedence(ops.top()) >= precedence(op)) {
-                long b = values.top(); values.pop();
-                long a = values.top(); values.pop();
-                char top_op = ops.top(); ops.pop();
-                values.push(apply_op(a, b, top_op));
+    }
+    expected = long(sum + sign * term);
+    return size_t(p - out);
+}
+
+// Распределение длины выражения
+enum class LengthDist {
+    Fixed,     // всегда n чисел
+    Zipf,      // степенной закон P(k) ~ k^-s на 1..n
+    LogNormal  // логнормальное с медианой median и параметром sigma, не больше n
+};
+
+// Модель нагрузки: длины выражений, смесь операторов, доля деления на ноль
+// и разрядность операндов. Без настроек используется быстрый
+// generate_expression (числа 1..10, равновероятные операторы, длина n).
+struct Workload {
+    bool custom = false;             // задана хотя бы одна настройка
+    LengthDist length = LengthDist::Fixed;
+    double zipf_s = 1.0;
+    double ln_median = 0;
+    double ln_sigma = 0;
+    uint64_t op_cum[3] = {1ull << 30, 2ull << 30, 3ull << 30}; // накопленные веса +,-,* из 2^32
+    uint64_t zero_div = 0;           // вероятность нулевого делителя, доля от 2^64
+    int min_digits = 0;              // 0 — операнды 1..10
+    int max_digits = 0;
+    std::string spec;                // описание для отчёта
+
+    // Наибольшее число разрядов операнда
+    int digits() const { return min_digits == 0 ? 2 : max_digits; }
+};
+
+// Максимальная длина выражения из n чисел: цифры операнда и оператор на число
+size_t max_expression_length(int n, const Workload& w) {
+    return size_t(n) * size_t(w.digits() + 1);
+}
+
+// Равномерное число из [0, 1)
+inline double unit_double(FastRng& rng) {
+    return double(rng.next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Равномерное число из [0, range) для 64-битных диапазонов
+inline uint64_t below64(FastRng& rng, uint64_t range) {
+    return uint64_t((unsigned __int128)rng.next() * range >> 64);
+}
+
+int draw_length(const Workload& w, int n, FastRng& rng) {
+    double len = n;
+    switch (w.length) {
+        case LengthDist::Fixed:
+            return n;
+        case LengthDist::Zipf: {
+            // Обращение функции распределения непрерывного степенного закона на [1, n+1)
+            double u = unit_double(rng);
+            if (std::fabs(w.zipf_s - 1.0) < 1e-9) {
+                len = std::pow(double(n) + 1, u);
+            } else {
+                double a = 1.0 - w.zipf_s;
+                len = std::pow(1.0 + u * (std::pow(double(n) + 1, a) - 1.0), 1.0 / a);
             }
-            ops.push(op);
+            break;
+        }
+        case LengthDist::LogNormal: {
+            // Нормальная величина по Боксу — Мюллеру
+            double u1 = 1.0 - unit_double(rng), u2 = unit_double(rng);
+            double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(2 * M_PI * u2);
+            len = std::round(w.ln_median * std::exp(w.ln_sigma * z));
+            break;
         }
     }
+    return int(std::clamp(len, 1.0, double(n)));
+}
+
+uint64_t draw_operand(const Workload& w, FastRng& rng) {
+    static const uint64_t pow10[19] = {
+        1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull,
+        100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull,
+        10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+        100000000000000000ull, 1000000000000000000ull};
+    if (w.min_digits == 0) return 1 + rng.below(10);
+    int d = w.min_digits + int(rng.below(uint32_t(w.max_digits - w.min_digits + 1)));
+    uint64_t lo = d == 1 ? 1 : pow10[d - 1];
+    return lo + below64(rng, pow10[d] - lo);
+}
+
+char draw_op(const Workload& w, FastRng& rng) {
+    uint64_t r = rng.next() >> 32;
+    if (r < w.op_cum[0]) return '+';
+    if (r < w.op_cum[1]) return '-';
+    if (r < w.op_cum[2]) return '*';
+    return '/';
+}
+
+// Генератор по модели нагрузки. Свёртка та же, что в generate_expression:
+// при 18-значных операндах произведения переполняются, а сервер выполняет
+// +, - и * в беззнаковой арифметике, так что результат совпадает с ним по
+// модулю 2^64. Деление знаковое, как у сервера; операнды меньше 2^63, поэтому
+// делитель -1 (единственный случай переполнения при делении) не возникает.
+// Деление на ноль где угодно в выражении делает ответом ERR (error = true).
+size_t generate_workload_expression(const Workload& w, int n, FastRng& rng, char* out,
+                                    long& expected, bool& error) {
+    int len = draw_length(w, n, rng);
+    char* p = out;
+    uint64_t sum = 0, term = 0, sign = 1;
+    char mul_op = 0;
+    error = false;
+    for (int i = 0; i < len; ++i) {
+        uint64_t v = mul_op == '/' && rng.next() < w.zero_div ? 0 : draw_operand(w, rng);
+        p = std::to_chars(p, p + 20, v).ptr;
+        if (mul_op == '*') term *= v;
+        else if (mul_op == '/') {
+            if (v == 0) error = true;
+            else term = uint64_t(int64_t(term) / int64_t(v));
+        }
+        else term = v;
 
-    // применяем оставшиеся операторы
-    while (!ops.empty()) {
-        long b = values.top(); values.pop();
-        long a = values.top(); values.pop();
-        char top_op = ops.top(); ops.pop();
-        values.push(apply_op(a, b, top_op));
+        if (i + 1 < len) {
+            char op = draw_op(w, rng);
+            *p++ = op;
+            if (op == '*' || op == '/') {
+                mul_op = op;
+            } else {
+                sum += sign * term;
+                sign = op == '+' ? 1 : uint64_t(-1);
+                mul_op = 0;
+            }
+        }
     }
+    expected = long(sum + sign * term);
+    return size_t(p - out);
+}
 
-    if (values.empty()) throw std::runtime_error("Empty expression");
-    return values.top();
+// Выражение по модели нагрузки; error — ожидается ответ ERR.
+// out должен вмещать max_expression_length(n, w) байт.
+size_t make_expression(const Workload& w, int n, FastRng& rng, char* out, long& expected,
+                       bool& error) {
+    if (w.custom) return generate_workload_expression(w, n, rng, out, expected, error);
+    error = false;
+    return generate_expression(n, rng, out, expected);
 }
 
-// Генерация случайного арифметического выражения из n чисел
-std::string build_expression(int n, std::mt19937 &rng) {
-    std::uniform_int_distribution<int> dist_num(1, 10); // числа от 1 до 10
-    std::uniform_int_distribution<int> dist_op(0, 3);   // операторы +, -, *, /
-    const char ops[4] = {'+', '-', '*', '/'};
-    std::ostringstream ss;
-    for (int i = 0; i < n; ++i) {
-        ss << dist_num(rng);
-        if (i + 1 < n) ss << ops[dist_op(rng)];
+// Разбор настроек модели нагрузки (--length, --ops, --zero-div, --operand-digits)
+bool parse_workload_option(const std::string& name, const std::string& value, Workload& w) {
+    if (name == "length") {
+        std::vector<std::string> parts;
+        std::stringstream ss(value);
+        for (std::string item; std::getline(ss, item, ':');) parts.push_back(item);
+        if (parts.empty()) return false;
+        if (parts[0] == "fixed" && parts.size() == 1) {
+            w.length = LengthDist::Fixed;
+        } else if (parts[0] == "zipf" && parts.size() == 2) {
+            w.length = LengthDist::Zipf;
+            w.zipf_s = std::stod(parts[1]);
+            if (w.zipf_s <= 0) return false;
+        } else if (parts[0] == "lognormal" && parts.size() == 3) {
+            w.length = LengthDist::LogNormal;
+            w.ln_median = std::stod(parts[1]);
+            w.ln_sigma = std::stod(parts[2]);
+            if (w.ln_median < 1 || w.ln_sigma < 0) return false;
+        } else {
+            return false;
+        }
+    } else if (name == "ops") {
+        double weights[4];
+        std::stringstream ss(value);
+        std::string item;
+        double total = 0;
+        for (double& x : weights) {
+            if (!std::getline(ss, item, ',')) return false;
+            x = std::stod(item);
+            if (x < 0) return false;
+            total += x;
+        }
+        if (total <= 0 || std::getline(ss, item, ',')) return false;
+        double cum = 0;
+        for (int i = 0; i < 3; ++i) {
+            cum += weights[i];
+            w.op_cum[i] = uint64_t(cum / total * 4294967296.0);
+        }
+    } else if (name == "zero-div") {
+        double p = std::stod(value);
+        if (p < 0 || p > 1) return false;
+        w.zero_div = p >= 1 ? UINT64_MAX : uint64_t(p * 18446744073709551616.0);
+    } else if (name == "operand-digits") {
+        size_t dash = value.find('-');
+        w.min_digits = std::stoi(value.substr(0, dash));
+        w.max_digits = dash == std::string::npos ? w.min_digits : std::stoi(value.substr(dash + 1));
+        if (w.min_digits < 1 || w.max_digits < w.min_digits || w.max_digits > 18) return false;
+    } else {
+        return false;
     }
-    return ss.str();
+    w.custom = true;
+    w.spec += (w.spec.empty() ? "" : " ") + ("--" + name + " " + value);
+    return true;
 }
 
-// Структура для хранения состояния одного соединения
-struct Connection {
-    std::string expr;                 // исходное выражение
-    std::vector<std::string> fragments; // фрагменты для отправки
-    size_t frag_idx = 0;              // индекс текущего фрагмента
-    size_t frag_offset = 0;           // смещение внутри фрагмента
-    std::string in_buf;               // буфер входящих данных
-    long expected;                    // ожидаемый результат
+// Монотонное время в наносекундах
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+// Гистограмма задержек в духе HDR Histogram: значения меньше 2^SUB_BITS хранятся
+// точно, а каждый следующий диапазон [2^k, 2^(k+1)) делится на 2^(SUB_BITS-1)
+// линейных подкорзин. Размер фиксирован, относительная погрешность < 1%.
+class Histogram {
+public:
+    static constexpr int SUB_BITS = 8;
+    static constexpr uint64_t SUB_COUNT = 1ull << SUB_BITS;
+    static constexpr uint64_t HALF = SUB_COUNT / 2;
+    static constexpr size_t BUCKETS = SUB_COUNT + (64 - SUB_BITS) * HALF;
+
+    Histogram() : counts_(BUCKETS, 0) {}
+
+    void record(uint64_t v) {
+        ++counts_[index_of(v)];
+        ++total_;
+        sum_ += v;
+        if (v < min_) min_ = v;
+        if (v > max_) max_ = v;
+    }
+
+    void merge(const Histogram& o) {
+        for (size_t i = 0; i < BUCKETS; ++i) counts_[i] += o.counts_[i];
+        total_ += o.total_;
+        sum_ += o.sum_;
+        min_ = std::min(min_, o.min_);
+        max_ = std::max(max_, o.max_);
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = sum_ = max_ = 0;
+        min_ = UINT64_MAX;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t min() const { return total_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return total_ ? double(sum_) / total_ : 0.0; }
+
+    // Текстовая строка для передачи координатору: итоги и ненулевые корзины
+    void write(FILE* f) const {
+        size_t used = size_t(std::count_if(counts_.begin(), counts_.end(),
+                                           [](uint64_t c) { return c != 0; }));
+        std::fprintf(f, "%llu %llu %llu %llu %zu", (unsigned long long)total_,
+                     (unsigned long long)sum_, (unsigned long long)min_,
+                     (unsigned long long)max_, used);
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            if (counts_[i]) std::fprintf(f, " %zu:%llu", i, (unsigned long long)counts_[i]);
+        }
+        std::fputc('\n', f);
+    }
+
+    // Разбор строки write(); false — строка повреждена
+    bool read(const std::string& line) {
+        reset();
+        const char* p = line.c_str();
+        char* end;
+        uint64_t head[5];
+        for (uint64_t& v : head) {
+            v = std::strtoull(p, &end, 10);
+            if (end == p) return false;
+            p = end;
+        }
+        total_ = head[0];
+        sum_ = head[1];
+        min_ = head[2];
+        max_ = head[3];
+        for (uint64_t k = 0; k < head[4]; ++k) {
+            uint64_t idx = std::strtoull(p, &end, 10);
+            if (end == p || *end != ':' || idx >= BUCKETS) return false;
+            p = end + 1;
+            counts_[idx] = std::strtoull(p, &end, 10);
+            if (end == p) return false;
+            p = end;
+        }
+        return true;
+    }
+
+    // Значение, не превышаемое долей p (в процентах) наблюдений
+    uint64_t percentile(double p) const {
+        if (total_ == 0) return 0;
+        uint64_t rank = uint64_t(std::ceil(p / 100.0 * total_));
+        if (rank == 0) rank = 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(highest_equivalent(i), max_);
+        }
+        return max_;
+    }
+
+private:
+    static size_t index_of(uint64_t v) {
+        if (v < SUB_COUNT) return size_t(v);
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - (SUB_BITS - 1);   // >= 1
+        uint64_t sub = v >> shift;          // в диапазоне [HALF, SUB_COUNT)
+        return size_t(SUB_COUNT + (shift - 1) * HALF + (sub - HALF));
+    }
+
+    static uint64_t highest_equivalent(size_t idx) {
+        if (idx < SUB_COUNT) return idx;
+        size_t k = idx - SUB_COUNT;
+        int shift = int(k / HALF) + 1;
+        uint64_t sub = k % HALF + HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
 };
 
-int main(int argc, char* argv[]) {
-    // Проверяем аргументы: n, connections, адрес и порт сервера
-    if (argc != 5) {
-        std::cerr << "Usage: " << argv[0]
-                  << " <n> <connections> <server_addr> <server_port>\n";
-        return 1;
+// Показатели одного секундного интервала прогона
+struct IntervalStats {
+    uint64_t second = 0;         // номер секунды от начала прогона
+    uint64_t connects = 0;
+    uint64_t connect_errors = 0;
+    uint64_t requests = 0;       // получено ответов
+    uint64_t mismatches = 0;
+    uint64_t timeouts = 0;       // запросы без ответа к истечению --timeout
+    uint64_t resets = 0;         // запросы, оборванные закрытием или сбросом соединения
+    uint64_t parse_failures = 0; // ответы, не разобранные ни как число, ни как ERR
+    uint64_t io_errors = 0;
+    uint64_t p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0; // задержка запросов за интервал, нс
+
+    void write(FILE* f) const {
+        std::fprintf(f, "%llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu\n",
+                     (unsigned long long)second, (unsigned long long)connects,
+                     (unsigned long long)connect_errors, (unsigned long long)requests,
+                     (unsigned long long)mismatches, (unsigned long long)timeouts,
+                     (unsigned long long)resets, (unsigned long long)parse_failures,
+                     (unsigned long long)io_errors, (unsigned long long)p50,
+                     (unsigned long long)p90, (unsigned long long)p99,
+                     (unsigned long long)p999, (unsigned long long)max);
     }
-    int n = std::stoi(argv[1]);            // количество чисел
-    int connections = std::stoi(argv[2]); // число параллельных сессий
-    const char* server_addr = argv[3];     // адрес сервера
-    int server_port = std::stoi(argv[4]);  // порт сервера
-
-    // Создаем epoll‑демон
-    int epoll_fd = epoll_create1(0);
-    if (epoll_fd < 0) { perror("epoll_create1"); return 1; }
-
-    // Инициализируем генератор случайных чисел
-    std::mt19937 rng(static_cast<unsigned>(
-        std::chrono::high_resolution_clock::now().time_since_epoch().count()));
-
-    std::unordered_map<int, Connection> conns;     // мапа fd -> Connection
-    std::vector<epoll_event> events(MAX_EVENTS);   // массив для epoll_wait
-
-    // Инициализируем все соединения
-    for (int i = 0; i < connections; ++i) {
-        Connection c;
-        c.expr = build_expression(n, rng);
-        c.expected = evaluate(c.expr);
-        std::cout << "[Conn " << i << "] Expr: " << c.expr
-                  << " Expected: " << c.expected << std::endl;
-
-        // Добавляем пробел в конце как разделитель
-        std::string msg = c.expr + ' ';
-
-        // Фрагментация строки на случайные куски
-        int pos = 0;
-        while (pos < (int)msg.size()) {
-            int max_len = msg.size() - pos;
-            int len = std::uniform_int_distribution<int>(1, max_len)(rng);
-            c.fragments.push_back(msg.substr(pos, len));
-            pos += len;
+
+    bool read(const std::string& line) {
+        std::istringstream in(line);
+        return bool(in >> second >> connects >> connect_errors >> requests >> mismatches >>
+                    timeouts >> resets >> parse_failures >> io_errors >> p50 >> p90 >> p99 >>
+                    p999 >> max);
+    }
+
+    // Сложение интервалов разных исполнителей. Перцентили из итоговых
+    // значений не складываются, берётся худший из исполнителей.
+    void merge(const IntervalStats& o) {
+        connects += o.connects;
+        connect_errors += o.connect_errors;
+        requests += o.requests;
+        mismatches += o.mismatches;
+        timeouts += o.timeouts;
+        resets += o.resets;
+        parse_failures += o.parse_failures;
+        io_errors += o.io_errors;
+        p50 = std::max(p50, o.p50);
+        p90 = std::max(p90, o.p90);
+        p99 = std::max(p99, o.p99);
+        p999 = std::max(p999, o.p999);
+        max = std::max(max, o.max);
+    }
+};
+
+// Сборщик посекундного ряда со всех потоков клиента. Потоки сдают закрытую
+// секунду раз в секунду, поэтому мьютекс не влияет на горячий путь. Секунда
+// готова, когда её сдали все потоки: гистограмма сворачивается в перцентили
+// и освобождается, так что память не растёт с длительностью прогона.
+class SeriesAggregator {
+public:
+    explicit SeriesAggregator(int sources) : sources_(sources) {}
+
+    void add(const IntervalStats& iv, const Histogram& latency) {
+        std::lock_guard<std::mutex> lock(mu_);
+        Slot& slot = open_[iv.second];
+        slot.counts.second = iv.second;
+        slot.counts.connects += iv.connects;
+        slot.counts.connect_errors += iv.connect_errors;
+        slot.counts.requests += iv.requests;
+        slot.counts.mismatches += iv.mismatches;
+        slot.counts.timeouts += iv.timeouts;
+        slot.counts.resets += iv.resets;
+        slot.counts.parse_failures += iv.parse_failures;
+        slot.counts.io_errors += iv.io_errors;
+        slot.latency.merge(latency);
+        if (++slot.received == sources_) {
+            done_.push_back(finalize(slot));
+            open_.erase(iv.second);
         }
+    }
 
-        // Создаем неблокирующий сокет и подключаемся
-        int fd = socket(AF_INET, SOCK_STREAM, 0);
-        set_nonblocking(fd);
-        sockaddr_in serv{};
-        serv.sin_family = AF_INET;
-        inet_pton(AF_INET, server_addr, &serv.sin_addr);
-        serv.sin_port = htons(server_port);
-        connect(fd, (sockaddr*)&serv, sizeof(serv));
+    // Все секунды по порядку; секунды, которые сдали не все потоки
+    // (часть потоков закончила раньше), сворачиваются как есть
+    std::vector<IntervalStats> intervals() {
+        std::lock_guard<std::mutex> lock(mu_);
+        for (auto& kv : open_) done_.push_back(finalize(kv.second));
+        open_.clear();
+        std::sort(done_.begin(), done_.end(),
+                  [](const IntervalStats& a, const IntervalStats& b) { return a.second < b.second; });
+        return done_;
+    }
 
-        // Регистрируем fd в epoll на чтение и запись
-        epoll_event ev{};
-        ev.data.fd = fd;
-        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
-        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
-
-        conns[fd] = std::move(c); // сохраняем состояние
-        std::cout << "[Conn " << i << "] Opened fd=" << fd << std::endl;
-    }
-
-    int active = conns.size(); // сколько еще активных соединений
-
-    // Основной цикл обработки событий
-    while (active > 0) {
-        int n_events = epoll_wait(epoll_fd, events.data(), MAX_EVENTS, -1);
-        if (n_events < 0 && errno == EINTR) continue;
-
-        for (int i = 0; i < n_events; ++i) {
-            int fd = events[i].data.fd;
-            uint32_t evs = events[i].events;
-            auto it = conns.find(fd);
-            if (it == conns.end()) continue;
-            Connection &c = it->second;
-
-            // Отправка фрагментов при готовности записи
-            if ((evs & EPOLLOUT) && c.frag_idx < c.fragments.size()) {
-                while (c.frag_idx < c.fragments.size()) {
-                    const std::string &frag = c.fragments[c.frag_idx];
-                    const char* data = frag.data() + c.frag_offset;
-                    size_t left = frag.size() - c.frag_offset;
-                    ssize_t sent = send(fd, data, left, 0);
-                    if (sent > 0) {
-                        c.frag_offset += sent;
-                        if (c.frag_offset == frag.size()) {
-                            c.frag_idx++;
-                            c.frag_offset = 0;
-                        }
-                    } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                        break;
-                    } else {
-                        close(fd);
-                        conns.erase(it);
-                        active--;
-                        goto next_fd;
-                    }
+private:
+    struct Slot {
+        IntervalStats counts;
+        Histogram latency;
+        int received = 0;
+    };
+
+    static IntervalStats finalize(const Slot& slot) {
+        IntervalStats iv = slot.counts;
+        iv.p50 = slot.latency.percentile(50);
+        iv.p90 = slot.latency.percentile(90);
+        iv.p99 = slot.latency.percentile(99);
+        iv.p999 = slot.latency.percentile(99.9);
+        iv.max = slot.latency.max();
+        return iv;
+    }
+
+    const int sources_;
+    std::mutex mu_;
+    std::map<uint64_t, Slot> open_;
+    std::vector<IntervalStats> done_;
+};
+
+// Посекундный временной ряд одного потока. Гистограмма держится только для
+// текущей секунды, закрытые секунды сдаются в общий SeriesAggregator.
+class TimeSeries {
+public:
+    void start(uint64_t t0, SeriesAggregator* sink) {
+        t0_ = t0;
+        sink_ = sink;
+        cur_ = IntervalStats{};
+        latency_.reset();
+    }
+
+    // Текущий интервал; завершившиеся к моменту now интервалы закрываются
+    IntervalStats& at(uint64_t now) {
+        uint64_t second = (now - t0_) / 1000000000ull;
+        while (cur_.second < second) close_interval();
+        return cur_;
+    }
+
+    void record_latency(uint64_t now, uint64_t v) {
+        at(now).requests++;
+        latency_.record(v);
+    }
+
+    // Запросы, не дождавшиеся ответа: время ожидания попадает в хвост
+    // распределения задержек, но в число ответов они не входят
+    void record_timeout(uint64_t now, uint64_t v, uint64_t count) {
+        at(now).timeouts += count;
+        for (uint64_t i = 0; i < count; i++) latency_.record(v);
+    }
+
+    // Закрывает последний (неполный) интервал; now — момент сразу после конца ряда
+    void finish(uint64_t now) {
+        if (now > t0_) at(now - 1);
+        close_interval();
+    }
+
+private:
+    void close_interval() {
+        sink_->add(cur_, latency_);
+        uint64_t next = cur_.second + 1;
+        cur_ = IntervalStats{};
+        cur_.second = next;
+        latency_.reset();
+    }
+
+    uint64_t t0_ = 0;
+    SeriesAggregator* sink_ = nullptr;
+    IntervalStats cur_;
+    Histogram latency_;
+};
+
+// Счётчик с единственным писателем: увеличивается без атомарных RMW-инструкций
+// и без блокировок, но его можно читать из других потоков (для прогресса)
+class Counter {
+public:
+    void add(uint64_t v = 1) {
+        v_.store(v_.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+    uint64_t get() const { return v_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> v_{0};
+};
+
+// Формат файла корпуса (порядок байт хоста, рассчитан на mmap):
+//   CorpusHeader | CorpusRecord[count] | тексты выражений
+// Каждое выражение в области текстов хранится вместе с завершающим пробелом,
+// поэтому запись можно отправлять в сокет прямо из отображённой памяти.
+constexpr char CORPUS_MAGIC[8] = {'T', 'C', 'P', 'C', 'O', 'R', 'P', '1'};
+constexpr uint32_t CORPUS_VERSION = 1;
+constexpr uint32_t CORPUS_HAS_TIMESTAMPS = 1u << 0;
+constexpr uint32_t CORPUS_RECORD_ERR = 1u << 0;      // ожидаемый ответ — ERR
+
+struct CorpusHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;           // CORPUS_HAS_TIMESTAMPS
+    uint64_t count;           // число записей
+    uint64_t seed;            // seed генератора, которым создан корпус
+    uint64_t records_offset;  // смещение массива CorpusRecord от начала файла
+    uint64_t data_offset;     // смещение области текстов от начала файла
+    uint64_t data_size;       // размер области текстов
+};
+
+struct CorpusRecord {
+    uint64_t offset;          // смещение выражения в области текстов
+    uint32_t length;          // длина выражения без разделителя
+    uint32_t flags;           // CORPUS_RECORD_ERR
+    int64_t expected;         // заранее вычисленный ответ
+    uint64_t timestamp_ns;    // момент отправки при записи, от начала прогона
+};
+
+// Корпус выражений, отображённый в память только для чтения
+class Corpus {
+public:
+    Corpus() = default;
+    Corpus(const Corpus&) = delete;
+    Corpus& operator=(const Corpus&) = delete;
+    ~Corpus() {
+        if (base_) munmap(base_, size_);
+    }
+
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) { perror(path.c_str()); return false; }
+        struct stat st;
+        if (fstat(fd, &st) < 0) { perror("fstat"); close(fd); return false; }
+        size_ = size_t(st.st_size);
+        if (size_ < sizeof(CorpusHeader)) {
+            std::cerr << path << ": file too small for a corpus\n";
+            close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) { perror("mmap"); return false; }
+        base_ = static_cast<char*>(p);
+
+        header_ = reinterpret_cast<const CorpusHeader*>(base_);
+        if (std::memcmp(header_->magic, CORPUS_MAGIC, sizeof(CORPUS_MAGIC)) != 0 ||
+            header_->version != CORPUS_VERSION) {
+            std::cerr << path << ": not a corpus file or unsupported version\n";
+            return false;
+        }
+        if (header_->records_offset > size_ ||
+            header_->count > (size_ - header_->records_offset) / sizeof(CorpusRecord) ||
+            header_->data_offset > size_ || header_->data_size > size_ - header_->data_offset) {
+            std::cerr << path << ": corrupted corpus header\n";
+            return false;
+        }
+        records_ = reinterpret_cast<const CorpusRecord*>(base_ + header_->records_offset);
+        data_ = base_ + header_->data_offset;
+        for (uint64_t i = 0; i < header_->count; ++i) {
+            const CorpusRecord& r = records_[i];
+            if (r.offset > header_->data_size || r.length >= header_->data_size - r.offset) {
+                std::cerr << path << ": record " << i << " is out of bounds\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t size() const { return header_ ? size_t(header_->count) : 0; }
+    uint64_t seed() const { return header_->seed; }
+    bool has_timestamps() const { return header_->flags & CORPUS_HAS_TIMESTAMPS; }
+
+    // Выражение без разделителя
+    std::string_view expr(size_t i) const {
+        return std::string_view(data_ + records_[i].offset, records_[i].length);
+    }
+    long expected(size_t i) const { return long(records_[i].expected); }
+    bool expected_error(size_t i) const { return records_[i].flags & CORPUS_RECORD_ERR; }
+    uint64_t timestamp(size_t i) const { return records_[i].timestamp_ns; }
+
+    // Область текстов и смещение выражения в ней
+    const char* data() const { return data_; }
+    uint64_t offset(size_t i) const { return records_[i].offset; }
+
+private:
+    char* base_ = nullptr;
+    size_t size_ = 0;
+    const CorpusHeader* header_ = nullptr;
+    const CorpusRecord* records_ = nullptr;
+    const char* data_ = nullptr;
+};
+
+// Накопитель записей корпуса с последующей записью в файл
+class CorpusWriter {
+public:
+    void add(std::string_view expr, long expected, bool error, uint64_t timestamp_ns) {
+        CorpusRecord r{};
+        r.offset = data_.size();
+        r.length = uint32_t(expr.size());
+        r.flags = error ? CORPUS_RECORD_ERR : 0;
+        r.expected = expected;
+        r.timestamp_ns = timestamp_ns;
+        records_.push_back(r);
+        data_.append(expr.data(), expr.size());
+        data_.push_back(' ');
+    }
+
+    // Записи с отметками времени сортируются по ним, чтобы корпус
+    // можно было воспроизводить по порядку. Тексты переставляются вслед за
+    // записями: соседние записи должны лежать подряд, чтобы несколько
+    // выражений отправлялись одним участком файла.
+    bool write(const std::string& path, uint64_t seed, bool with_timestamps) {
+        if (with_timestamps) {
+            std::stable_sort(records_.begin(), records_.end(),
+                             [](const CorpusRecord& a, const CorpusRecord& b) {
+                                 return a.timestamp_ns < b.timestamp_ns;
+                             });
+            std::string ordered;
+            ordered.reserve(data_.size());
+            for (CorpusRecord& r : records_) {
+                uint64_t offset = ordered.size();
+                ordered.append(data_, r.offset, r.length + 1);
+                r.offset = offset;
+            }
+            data_.swap(ordered);
+        }
+        CorpusHeader h{};
+        std::memcpy(h.magic, CORPUS_MAGIC, sizeof(CORPUS_MAGIC));
+        h.version = CORPUS_VERSION;
+        h.flags = with_timestamps ? CORPUS_HAS_TIMESTAMPS : 0;
+        h.count = records_.size();
+        h.seed = seed;
+        h.records_offset = sizeof(CorpusHeader);
+        h.data_offset = h.records_offset + records_.size() * sizeof(CorpusRecord);
+        h.data_size = data_.size();
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.write(reinterpret_cast<const char*>(records_.data()),
+                  records_.size() * sizeof(CorpusRecord));
+        out.write(data_.data(), data_.size());
+        if (!out) {
+            std::cerr << path << ": failed to write corpus\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Добавляет записи другого накопителя
+    void merge(const CorpusWriter& o) {
+        uint64_t base = data_.size();
+        for (CorpusRecord r : o.records_) {
+            r.offset += base;
+            records_.push_back(r);
+        }
+        data_ += o.data_;
+    }
+
+    size_t size() const { return records_.size(); }
+
+private:
+    std::vector<CorpusRecord> records_;
+    std::string data_;
+};
+
+// Стратегия разбиения отправляемых данных на фрагменты
+enum class FragMode {
+    Random,    // случайная длина от 1 до остатка сообщения
+    Byte,      // по одному байту
+    Fixed,     // фрагменты фиксированной длины
+    Geometric, // длины с геометрическим распределением
+    Whole      // всё сообщение одним send()
+};
+
+struct FragmentSpec {
+    FragMode mode = FragMode::Random;
+    size_t size = 0;         // длина фрагмента для Fixed
+    double mean = 0;         // средняя длина для Geometric
+    int coalesce = 1;        // сколько выражений склеивать в одно сообщение
+    uint64_t delay_ns = 0;   // пауза между фрагментами
+};
+
+// Разбор значения --fragment: random, byte, fixed:N, geometric:MEAN, whole, coalesce:K
+bool parse_fragment_spec(const std::string& value, FragmentSpec& spec) {
+    std::string kind = value, arg;
+    size_t colon = value.find(':');
+    if (colon != std::string::npos) {
+        kind = value.substr(0, colon);
+        arg = value.substr(colon + 1);
+    }
+    if (kind == "random" && arg.empty()) {
+        spec.mode = FragMode::Random;
+    } else if (kind == "byte" && arg.empty()) {
+        spec.mode = FragMode::Byte;
+    } else if (kind == "whole" && arg.empty()) {
+        spec.mode = FragMode::Whole;
+    } else if (kind == "fixed" && !arg.empty()) {
+        spec.mode = FragMode::Fixed;
+        spec.size = std::stoul(arg);
+        if (spec.size == 0) return false;
+    } else if (kind == "geometric" && !arg.empty()) {
+        spec.mode = FragMode::Geometric;
+        spec.mean = std::stod(arg);
+        if (spec.mean < 1) return false;
+    } else if (kind == "coalesce" && !arg.empty()) {
+        // Несколько выражений уходят одним буфером, границы выражений
+        // оказываются внутри одного сегмента
+        spec.mode = FragMode::Whole;
+        spec.coalesce = std::stoi(arg);
+        if (spec.coalesce < 1) return false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Конец следующего фрагмента сообщения длины size, если отправлено sent байт.
+// Длины выбираются по мере отправки, поэтому границы фрагментов не хранятся.
+uint32_t next_fragment_end(uint32_t sent, uint32_t size, const FragmentSpec& spec,
+                           std::mt19937& rng) {
+    uint32_t left = size - sent, frag = left;
+    switch (spec.mode) {
+        case FragMode::Random:
+            frag = std::uniform_int_distribution<uint32_t>(1, left)(rng);
+            break;
+        case FragMode::Byte:
+            frag = 1;
+            break;
+        case FragMode::Fixed:
+            frag = uint32_t(std::min<size_t>(spec.size, left));
+            break;
+        case FragMode::Geometric:
+            frag = uint32_t(std::min<size_t>(
+                left, 1 + std::geometric_distribution<size_t>(1.0 / spec.mean)(rng)));
+            break;
+        case FragMode::Whole:
+            break;
+    }
+    return sent + frag;
+}
+
+// Поведение «плохих» клиентов, подключаемых параллельно с основной нагрузкой
+enum class AdvMode {
+    Slowloris, // по одному байту выражения за интервал
+    NoRead,    // конвейер выражений без чтения ответов
+    Endless,   // бесконечное выражение без разделителя
+    ErrFlood   // поток выражений 1/0, на каждое сервер отвечает ERR
+};
+
+struct AdversarySpec {
+    AdvMode mode;
+    int count;     // сколько таких соединений держать открытыми
+};
+
+const char* adv_mode_name(AdvMode m) {
+    switch (m) {
+        case AdvMode::Slowloris: return "slowloris";
+        case AdvMode::NoRead:    return "noread";
+        case AdvMode::Endless:   return "endless";
+        case AdvMode::ErrFlood:  return "errflood";
+    }
+    return "?";
+}
+
+// Разбор значения --adversary: MODE:COUNT[,MODE:COUNT...]
+bool parse_adversaries(const std::string& value, std::vector<AdversarySpec>& out) {
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) return false;
+        std::string kind = item.substr(0, colon);
+        AdversarySpec spec{};
+        if (kind == "slowloris")     spec.mode = AdvMode::Slowloris;
+        else if (kind == "noread")   spec.mode = AdvMode::NoRead;
+        else if (kind == "endless")  spec.mode = AdvMode::Endless;
+        else if (kind == "errflood") spec.mode = AdvMode::ErrFlood;
+        else return false;
+        spec.count = std::stoi(item.substr(colon + 1));
+        if (spec.count < 1) return false;
+        out.push_back(spec);
+    }
+    return !out.empty();
+}
+
+// Адрес и порт одного сервера: основного, B из --ab или из --endpoints
+struct ServerAddr {
+    std::string addr;
+    int port = 0;
+};
+
+// Выбор сервера для нового соединения при нескольких --endpoints
+enum class Balance {
+    RoundRobin,  // по очереди
+    Least,       // с наименьшим числом незавершённых запросов
+    PowerOfTwo,  // меньше загруженный из двух случайных
+};
+constexpr int MAX_BALANCED_ENDPOINTS = 64;
+
+const char* balance_name(Balance b) {
+    switch (b) {
+        case Balance::RoundRobin: return "rr";
+        case Balance::Least: return "least";
+        case Balance::PowerOfTwo: return "p2c";
+    }
+    return "?";
+}
+
+// Параметры запуска клиента
+struct Options {
+    int n = 0;                 // количество чисел в выражении
+    int connections = 0;       // число сессий (в режиме churn — предел одновременно открытых)
+    std::string server_addr;   // адрес сервера
+    int server_port = 0;       // порт сервера
+    int requests = 1;          // выражений на одно соединение
+    double ramp_rate = 0;      // скорость открытия соединений, шт/с (0 — все сразу)
+    double churn_rate = 0;     // режим churn: новых соединений в секунду (0 — выключен)
+    long churn_count = 0;      // режим churn: всего циклов connect→request→close
+    bool requests_set = false; // --requests указан явно
+    uint64_t seed = 0;         // seed генератора выражений
+    bool seed_set = false;     // --seed указан явно
+    std::string corpus;        // воспроизводимый корпус
+    bool replay_recorded = false; // воспроизводить с записанными интервалами
+    std::string record_corpus; // куда записать отправленные выражения
+    std::string make_corpus;   // только сгенерировать корпус и выйти
+    long corpus_size = 0;      // размер генерируемого корпуса
+    std::string report_json;   // итоговый отчёт в JSON
+    std::string report_csv;    // посекундный ряд и итоговая строка в CSV
+    FragmentSpec fragment;     // разбиение сообщений на фрагменты
+    double duration = 0;       // длительность измерения, с (0 — до исчерпания запросов)
+    double warmup = 0;         // прогрев перед измерением, с
+    double cooldown = 0;       // нагрузка после окна измерения, с
+    int threads = 1;           // потоков клиента, у каждого свой epoll
+    bool quiet = false;        // без построчного вывода, только счётчики и дайджест
+    int mismatch_samples = 10; // сколько расхождений печатать в тихом режиме
+    long arena = 0;            // сколько выражений заранее сгенерировать в общую арену
+    std::vector<in_addr> source_addrs; // локальные адреса для исходящих соединений
+    bool hold = false;         // не закрывать соединения, выполнившие свои запросы
+    std::vector<AdversarySpec> adversaries; // «плохие» соединения параллельно с нагрузкой
+    uint64_t adversary_interval_ns = 100000000; // как часто они отправляют очередную порцию
+    bool uring = false;        // движок io_uring вместо epoll
+    Workload workload;         // распределения длин, операторов и операндов
+    std::string ab_addr;       // режим A/B: второй сервер (B)
+    int ab_port = 0;
+    std::vector<ServerAddr> replicas; // --endpoints: ещё серверы, между которыми делится нагрузка
+    Balance balance = Balance::Least;
+    uint64_t timeout_ns = 10000000000ull; // предел ожидания connect и ответа (0 — без предела)
+    bool kernel_timestamps = false; // задержка по временным меткам ядра (SO_TIMESTAMPING)
+    bool burst = false;        // первые сообщения всех соединений — одним залпом после барьера
+    uint64_t slo_p99_ns = 0;   // поиск наибольшей нагрузки с p99 не выше этого (0 — обычный прогон)
+    int search_start = 1;      // с какого числа соединений начинать поиск
+    int workers = 0;           // координатор: сколько процессов-исполнителей ждать
+    int spawn = 0;             // из них запустить на этой машине
+    int control_port = 0;      // порт управляющего сокета координатора (0 — любой свободный)
+    std::string join;          // исполнитель: адрес координатора host:port
+    int shard_index = 0;       // доля исполнителя: часть корпуса shard_index из shard_count
+    int shard_count = 1;
+};
+
+// Разбор списка адресов: a.b.c.d[,a.b.c.d-a.b.c.d...]
+bool parse_addr_list(const std::string& value, std::vector<in_addr>& out) {
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::string first = item, last = item;
+        size_t dash = item.find('-');
+        if (dash != std::string::npos) {
+            first = item.substr(0, dash);
+            last = item.substr(dash + 1);
+        }
+        in_addr a{}, b{};
+        if (inet_pton(AF_INET, first.c_str(), &a) != 1 ||
+            inet_pton(AF_INET, last.c_str(), &b) != 1) {
+            return false;
+        }
+        uint32_t from = ntohl(a.s_addr), to = ntohl(b.s_addr);
+        if (from > to || to - from > 65535) return false;
+        for (uint64_t ip = from; ip <= to; ++ip) {
+            in_addr x{};
+            x.s_addr = htonl(uint32_t(ip));
+            out.push_back(x);
+        }
+    }
+    return !out.empty();
+}
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog
+              << " [options] <n> <connections> <server_addr> <server_port>\n"
+              << "Options:\n"
+              << "  --requests K       expressions per connection (default 1)\n"
+              << "  --ramp-rate R      open connections at R per second (default: all at once)\n"
+              << "  --churn-rate R     churn mode: connect->request->close at R connections/s,\n"
+              << "                     <connections> caps the number of concurrently open ones\n"
+              << "  --churn-count N    churn mode: total number of connections (default <connections>)\n"
+              << "  --seed S           seed for expression generation (default: time-based)\n"
+              << "  --corpus FILE      replay expressions and answers from a corpus file;\n"
+              << "                     connections pull records until the corpus is exhausted\n"
+              << "  --replay MODE      corpus pacing: max (default) or recorded\n"
+              << "  --record-corpus FILE  save every sent expression with its send time\n"
+              << "  --make-corpus FILE --corpus-size N  generate a corpus of N expressions\n"
+              << "                     of <n> numbers and exit (only <n> is required)\n"
+              << "  --report-json FILE write a summary with percentiles, CPU usage and a\n"
+              << "                     per-second time series as JSON\n"
+              << "  --report-csv FILE  write the per-second time series and a total row as CSV\n"
+              << "  --fragment MODE    how messages are split into send() calls: random (default),\n"
+              << "                     byte, fixed:N, geometric:MEAN, whole, or coalesce:K\n"
+              << "                     (K expressions pipelined in one send)\n"
+              << "  --fragment-delay US  pause between fragments of one message, microseconds\n"
+              << "  --duration S       measure for S seconds; persistent connections keep sending\n"
+              << "                     and churn keeps opening connections until the run ends\n"
+              << "  --warmup S         run S seconds of load before measuring (needs --duration)\n"
+              << "  --cooldown S       keep the load S seconds after measuring (needs --duration)\n"
+              << "  --threads T        split connections across T event-loop threads (default 1)\n"
+              << "  --quiet            no per-connection output: count results, print progress\n"
+              << "                     once a second and a final digest of all results\n"
+              << "  --mismatch-samples K  in quiet mode, print at most K mismatches (default 10)\n"
+              << "  --arena N          pre-generate N expressions into an arena shared by all\n"
+              << "                     connections instead of generating per request\n"
+              << "  --source-addrs LIST  bind outgoing connections round-robin to local addresses,\n"
+              << "                     e.g. 127.0.0.1-127.0.0.40 (IP_BIND_ADDRESS_NO_PORT)\n"
+              << "  --hold             keep connections open after their requests until --duration ends\n"
+              << "  --adversary LIST   attach misbehaving connections while measuring the regular\n"
+              << "                     ones: MODE:COUNT[,MODE:COUNT...], MODE is slowloris (one\n"
+              << "                     byte per interval), noread (never read replies), endless\n"
+              << "                     (no delimiter) or errflood (stream of 1/0)\n"
+              << "  --adversary-interval MS  how often each misbehaving connection sends (default 100)\n"
+              << "  --burst            thundering herd: open all connections first, wait on a\n"
+              << "                     barrier across threads, then send every first message\n"
+              << "                     whole at the same instant; reports send spread, drain\n"
+              << "                     time and the latency distribution of the burst\n"
+              << "  --slo-p99 MS       search mode: find the largest number of connections (up to\n"
+              << "                     <connections>) whose p99 stays within MS milliseconds; each\n"
+              << "                     step is a --warmup + --duration run, the report shows the\n"
+              << "                     latency curve and the throughput knee\n"
+              << "  --search-start C   connections in the first search step (default 1)\n"
+              << "  --workers N        coordinator: split the load across N client processes, start\n"
+              << "                     them at the same moment and merge their histograms and\n"
+              << "                     counters into one report\n"
+              << "  --spawn K          coordinator: start K of the workers on this host\n"
+              << "  --control-port P   coordinator: control socket port (default: any free port)\n"
+              << "  --join ADDR:PORT   run as a worker of the coordinator at ADDR:PORT; all other\n"
+              << "                     options come from the coordinator\n"
+              << "  --timeout MS       give up on a connect or a message without a reply after MS\n"
+              << "                     milliseconds and close the connection (default 10000, 0: never)\n"
+              << "  --timestamps T     request latency source: user (default, clock_gettime in the\n"
+              << "                     client) or kernel (SO_TIMESTAMPING: software TX timestamp\n"
+              << "                     of the last fragment to RX timestamp of the reply; epoll only)\n"
+              << "  --engine E         event engine: epoll (default) or uring (io_uring with batched\n"
+              << "                     connect/send/recv; falls back to epoll if unavailable)\n"
+              << "  --length DIST      expression length: fixed (default, <n> numbers),\n"
+              << "                     zipf:S (power law on 1..<n>) or lognormal:MEDIAN:SIGMA\n"
+              << "                     (capped at <n>)\n"
+              << "  --ops W+,W-,W*,W/  operator weights (default 1,1,1,1)\n"
+              << "  --zero-div P       probability that a divisor is 0 (the server answers ERR)\n"
+              << "  --operand-digits A[-B]  operands with A..B digits, up to 18 (default: operand\n"
+              << "                     values 1..10)\n"
+              << "  --ab ADDR:PORT     A/B mode: drive <server_addr>:<server_port> (A) and this\n"
+              << "                     server (B) at once with interleaved connections and the\n"
+              << "                     same expressions, compare results and performance\n"
+              << "  --endpoints LIST   more servers ADDR:PORT[,ADDR:PORT...] sharing the load with\n"
+              << "                     <server_addr>:<server_port>; each connection picks one\n"
+              << "  --balance POLICY   how connections pick a server: rr (round robin), least (fewest\n"
+              << "                     outstanding requests, default) or p2c (power of two choices)\n";
+}
+
+// Разбор аргументов: позиционные параметры и опции вида --name value или --name=value
+bool parse_options(int argc, char* argv[], Options& opt) {
+    std::vector<std::string> positional;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+            std::string name = arg.substr(2), value;
+            // Флаги без значения
+            if (name == "quiet") {
+                opt.quiet = true;
+                continue;
+            }
+            if (name == "hold") {
+                opt.hold = true;
+                continue;
+            }
+            if (name == "burst") {
+                opt.burst = true;
+                continue;
+            }
+            size_t eq = name.find('=');
+            if (eq != std::string::npos) {
+                value = name.substr(eq + 1);
+                name.erase(eq);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                std::cerr << "Missing value for --" << name << "\n";
+                return false;
+            }
+
+            if (name == "requests") {
+                opt.requests = std::stoi(value);
+                opt.requests_set = true;
+            }
+            else if (name == "ramp-rate")   opt.ramp_rate = std::stod(value);
+            else if (name == "churn-rate")  opt.churn_rate = std::stod(value);
+            else if (name == "churn-count") opt.churn_count = std::stol(value);
+            else if (name == "seed") {
+                opt.seed = std::stoull(value);
+                opt.seed_set = true;
+            }
+            else if (name == "corpus")        opt.corpus = value;
+            else if (name == "record-corpus") opt.record_corpus = value;
+            else if (name == "make-corpus")   opt.make_corpus = value;
+            else if (name == "corpus-size")   opt.corpus_size = std::stol(value);
+            else if (name == "report-json")   opt.report_json = value;
+            else if (name == "report-csv")    opt.report_csv = value;
+            else if (name == "fragment") {
+                if (!parse_fragment_spec(value, opt.fragment)) {
+                    std::cerr << "Invalid fragmentation strategy " << value << "\n";
+                    return false;
+                }
+            }
+            else if (name == "fragment-delay") {
+                opt.fragment.delay_ns = uint64_t(std::stod(value) * 1000);
+            }
+            else if (name == "duration") opt.duration = std::stod(value);
+            else if (name == "warmup")   opt.warmup = std::stod(value);
+            else if (name == "cooldown") opt.cooldown = std::stod(value);
+            else if (name == "threads")  opt.threads = std::stoi(value);
+            else if (name == "mismatch-samples") opt.mismatch_samples = std::stoi(value);
+            else if (name == "arena") opt.arena = std::stol(value);
+            else if (name == "source-addrs") {
+                if (!parse_addr_list(value, opt.source_addrs)) {
+                    std::cerr << "Invalid address list " << value << "\n";
+                    return false;
                 }
-                // Если все фрагменты отправлены — отключаем EPOLLOUT
-                if (c.frag_idx == c.fragments.size()) {
-                    epoll_event mod{};
-                    mod.data.fd = fd;
-                    mod.events = EPOLLIN | EPOLLET;
-                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &mod);
+            }
+            else if (name == "adversary") {
+                if (!parse_adversaries(value, opt.adversaries)) {
+                    std::cerr << "Invalid adversary list " << value << "\n";
+                    return false;
                 }
             }
-
-            // Приём ответа при готовности чтения
-            if (evs & EPOLLIN) {
-                char buf[64];
-                while (true) {
-                    ssize_t count = recv(fd, buf, sizeof(buf), 0);
-                    if (count > 0) {
-                        c.in_buf.append(buf, count);
-                    } else if (count == 0 ||
-                              (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))) {
-                        break;
-                    } else {
-                        break;
-                    }
+            else if (name == "adversary-interval") {
+                opt.adversary_interval_ns = uint64_t(std::stod(value) * 1e6);
+                if (opt.adversary_interval_ns == 0) {
+                    std::cerr << "--adversary-interval must be positive\n";
+                    return false;
                 }
-                // Проверяем разделитель (пробел)
-                size_t pos;
-                if ((pos = c.in_buf.find(' ')) != std::string::npos) {
-                    std::string resp = c.in_buf.substr(0, pos);
-                    long server_res = std::stol(resp);
-                    if (server_res != c.expected) {
-                        std::cerr << "Mismatch! Expr: " << c.expr
-                                  << ", Server: " << server_res
-                                  << ", Expected: " << c.expected << std::endl;
-                    } else {
-                        std::cout << "Match! Expr: " << c.expr
-                                  << ", Result: " << server_res << std::endl;
+            }
+            else if (name == "timeout") {
+                double ms = std::stod(value);
+                if (ms < 0) {
+                    std::cerr << "--timeout must not be negative\n";
+                    return false;
+                }
+                opt.timeout_ns = uint64_t(ms * 1e6);
+            }
+            else if (name == "length" || name == "ops" || name == "zero-div" ||
+                     name == "operand-digits") {
+                if (!parse_workload_option(name, value, opt.workload)) {
+                    std::cerr << "Invalid value for --" << name << ": " << value << "\n";
+                    return false;
+                }
+            }
+            else if (name == "ab") {
+                size_t colon = value.rfind(':');
+                in_addr a{};
+                if (colon == std::string::npos ||
+                    inet_pton(AF_INET, value.substr(0, colon).c_str(), &a) != 1) {
+                    std::cerr << "Invalid --ab endpoint " << value << ", expected ADDR:PORT\n";
+                    return false;
+                }
+                opt.ab_addr = value.substr(0, colon);
+                opt.ab_port = std::stoi(value.substr(colon + 1));
+            }
+            else if (name == "endpoints") {
+                std::stringstream ss(value);
+                std::string item;
+                while (std::getline(ss, item, ',')) {
+                    size_t colon = item.rfind(':');
+                    in_addr a{};
+                    if (colon == std::string::npos ||
+                        inet_pton(AF_INET, item.substr(0, colon).c_str(), &a) != 1) {
+                        std::cerr << "Invalid endpoint " << item << ", expected ADDR:PORT\n";
+                        return false;
                     }
-                    close(fd);
-                    conns.erase(it);
-                    active--;
+                    opt.replicas.push_back(ServerAddr{item.substr(0, colon),
+                                                      std::stoi(item.substr(colon + 1))});
+                }
+            }
+            else if (name == "balance") {
+                if (value == "rr")         opt.balance = Balance::RoundRobin;
+                else if (value == "least") opt.balance = Balance::Least;
+                else if (value == "p2c")   opt.balance = Balance::PowerOfTwo;
+                else {
+                    std::cerr << "Unknown balancing policy " << value << "\n";
+                    return false;
+                }
+            }
+            else if (name == "engine") {
+                if (value != "epoll" && value != "uring") {
+                    std::cerr << "Unknown engine " << value << "\n";
+                    return false;
+                }
+                opt.uring = value == "uring";
+            }
+            else if (name == "slo-p99") {
+                opt.slo_p99_ns = uint64_t(std::stod(value) * 1e6);
+                if (opt.slo_p99_ns == 0) {
+                    std::cerr << "--slo-p99 must be positive\n";
+                    return false;
+                }
+            }
+            else if (name == "search-start") opt.search_start = std::stoi(value);
+            else if (name == "workers")      opt.workers = std::stoi(value);
+            else if (name == "spawn")        opt.spawn = std::stoi(value);
+            else if (name == "control-port") opt.control_port = std::stoi(value);
+            else if (name == "join")         opt.join = value;
+            else if (name == "timestamps") {
+                if (value != "user" && value != "kernel") {
+                    std::cerr << "Unknown timestamp source " << value << "\n";
+                    return false;
+                }
+                opt.kernel_timestamps = value == "kernel";
+            }
+            else if (name == "replay") {
+                if (value != "max" && value != "recorded") {
+                    std::cerr << "Unknown replay mode " << value << "\n";
+                    return false;
                 }
+                opt.replay_recorded = value == "recorded";
+            }
+            else {
+                std::cerr << "Unknown option --" << name << "\n";
+                return false;
+            }
+        }
+        if (!opt.make_corpus.empty()) {
+            // Генерация корпуса: нужна только длина выражения
+            if (positional.size() != 1) return false;
+            opt.n = std::stoi(positional[0]);
+            return opt.n >= 1 && opt.n <= MAX_TERMS &&
+                   max_expression_length(opt.n, opt.workload) < UINT32_MAX && opt.corpus_size >= 1;
+        }
+        // Исполнитель получает остальные параметры от координатора
+        if (!opt.join.empty()) return positional.empty();
+        if (positional.size() != 4) return false;
+        opt.n = std::stoi(positional[0]);
+        opt.connections = std::stoi(positional[1]);
+        opt.server_addr = positional[2];
+        opt.server_port = std::stoi(positional[3]);
+    } catch (const std::exception&) {
+        std::cerr << "Invalid numeric argument\n";
+        return false;
+    }
+    if ((opt.n < 1 && opt.corpus.empty()) || opt.n > MAX_TERMS ||
+        max_expression_length(opt.n, opt.workload) >= UINT32_MAX ||
+        opt.connections < 1 || opt.requests < 1) {
+        return false;
+    }
+    if (opt.duration < 0 || opt.warmup < 0 || opt.cooldown < 0 || opt.threads < 1 ||
+        opt.arena < 0) {
+        return false;
+    }
+    if (opt.duration == 0 && (opt.warmup > 0 || opt.cooldown > 0)) {
+        std::cerr << "--warmup and --cooldown require --duration\n";
+        return false;
+    }
+    if (opt.hold && opt.duration == 0) {
+        std::cerr << "--hold requires --duration\n";
+        return false;
+    }
+    if (opt.arena > 0 && !opt.corpus.empty()) {
+        std::cerr << "--arena and --corpus are mutually exclusive\n";
+        return false;
+    }
+    if (opt.slo_p99_ns > 0) {
+        if (opt.duration == 0) {
+            std::cerr << "--slo-p99 requires --duration (the length of each step)\n";
+            return false;
+        }
+        if (!opt.ab_addr.empty() || opt.burst || opt.churn_rate > 0 || opt.hold ||
+            !opt.corpus.empty() || !opt.record_corpus.empty() || !opt.adversaries.empty() ||
+            !opt.report_csv.empty() || opt.search_start < 1) {
+            std::cerr << "--slo-p99 cannot be combined with --ab, --burst, --churn-rate, --hold, "
+                         "--corpus, --record-corpus, --adversary or --report-csv\n";
+            return false;
+        }
+    }
+    if (opt.workers > 0) {
+        if (opt.spawn < 0 || opt.spawn > opt.workers || opt.control_port < 0) return false;
+        if (!opt.ab_addr.empty() || opt.burst || opt.slo_p99_ns > 0 ||
+            !opt.record_corpus.empty() || !opt.adversaries.empty()) {
+            std::cerr << "--workers cannot be combined with --ab, --burst, --slo-p99, "
+                         "--record-corpus or --adversary\n";
+            return false;
+        }
+    }
+    if (opt.burst && (opt.churn_rate > 0 || opt.replay_recorded)) {
+        std::cerr << "--burst cannot be combined with --churn-rate or --replay recorded\n";
+        return false;
+    }
+    if (!opt.replicas.empty()) {
+        if (!opt.ab_addr.empty()) {
+            std::cerr << "--endpoints cannot be combined with --ab\n";
+            return false;
+        }
+        if (opt.replicas.size() + 1 > size_t(MAX_BALANCED_ENDPOINTS)) {
+            std::cerr << "At most " << MAX_BALANCED_ENDPOINTS << " endpoints are supported\n";
+            return false;
+        }
+    }
+    if (opt.kernel_timestamps && opt.uring) {
+        std::cerr << "--timestamps kernel requires --engine epoll\n";
+        return false;
+    }
+    // Прогон по времени: соединения работают до его окончания,
+    // а churn открывает новые соединения без ограничения по количеству
+    if (opt.churn_count == 0) opt.churn_count = opt.duration > 0 ? LONG_MAX : opt.connections;
+    // Постоянные соединения при воспроизведении корпуса или прогоне по времени
+    // по умолчанию работают до исчерпания корпуса или окончания прогона
+    if ((!opt.corpus.empty() || opt.duration > 0) && !opt.requests_set && opt.churn_rate <= 0) {
+        opt.requests = INT32_MAX;
+    }
+    if (!opt.seed_set) {
+        opt.seed = uint64_t(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    }
+    return true;
+}
+
+// Минимальная обёртка io_uring поверх системных вызовов (без liburing).
+// Кольца отображаются одним mmap (IORING_FEAT_SINGLE_MMAP), ожидание с
+// таймаутом — через IORING_ENTER_EXT_ARG, поэтому нужно ядро 5.11+.
+class Uring {
+public:
+    Uring() = default;
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+    ~Uring() {
+        if (sqes_) munmap(sqes_, sqes_size_);
+        if (ring_) munmap(ring_, ring_size_);
+        if (fd_ >= 0) close(fd_);
+    }
+
+    // false — io_uring недоступен, errno описывает причину
+    bool init(unsigned entries) {
+        io_uring_params p{};
+        fd_ = int(syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0) return false;
+        if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+            errno = ENOTSUP;
+            return false;
+        }
+        ring_size_ = std::max<size_t>(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                                      p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe));
+        void* ring = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd_, IORING_OFF_SQ_RING);
+        if (ring == MAP_FAILED) return false;
+        ring_ = static_cast<char*>(ring);
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd_, IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) return false;
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        sq_head_ = reinterpret_cast<unsigned*>(ring_ + p.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(ring_ + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(ring_ + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        cq_head_ = reinterpret_cast<unsigned*>(ring_ + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(ring_ + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(ring_ + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(ring_ + p.cq_off.cqes);
+        // Индексы SQE совпадают с позициями в кольце
+        unsigned* array = reinterpret_cast<unsigned*>(ring_ + p.sq_off.array);
+        for (unsigned i = 0; i < p.sq_entries; ++i) array[i] = i;
+        return true;
+    }
+
+    // Обеспечивает n свободных мест в очереди отправки. Если очередь заполнена,
+    // накопленное отправляется в ядро. Ядро может не забрать ничего (EBUSY/EAGAIN),
+    // пока очередь завершений переполнена: тогда готовые завершения переносятся
+    // в backlog_ (их обработает drain), и отправка повторяется. false — место так
+    // и не освободилось, операцию нужно отложить или отменить
+    bool reserve(unsigned n) {
+        for (int attempt = 0; sq_free() < n; ++attempt) {
+            if (attempt == SQ_FULL_RETRIES) return false;
+            if (submit(0, 0) < 0 && errno != EBUSY && errno != EAGAIN && errno != EINTR) return false;
+            if (sq_free() < n) stash_completions();
+        }
+        return true;
+    }
+
+    // Свободный SQE или nullptr, если очередь не освободилась (см. reserve)
+    io_uring_sqe* sqe() {
+        if (!reserve(1)) return nullptr;
+        io_uring_sqe* s = &sqes_[tail_ & sq_mask_];
+        tail_++;
+        std::memset(s, 0, sizeof(*s));
+        return s;
+    }
+
+    // Есть завершения, перенесённые из кольца и ещё не обработанные
+    bool backlogged() const { return !backlog_.empty(); }
+
+    // Отправляет накопленные SQE одним вызовом и ждёт не менее wait_nr
+    // завершений, но не дольше timeout_ns (UINT64_MAX — без ограничения)
+    int submit(unsigned wait_nr, uint64_t timeout_ns) {
+        __atomic_store_n(sq_tail_, tail_, __ATOMIC_RELEASE);
+        unsigned to_submit = tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        unsigned flags = IORING_ENTER_EXT_ARG;
+        __kernel_timespec ts{};
+        io_uring_getevents_arg arg{};
+        if (wait_nr > 0) {
+            flags |= IORING_ENTER_GETEVENTS;
+            if (timeout_ns != UINT64_MAX) {
+                ts.tv_sec = int64_t(timeout_ns / 1000000000ull);
+                ts.tv_nsec = int64_t(timeout_ns % 1000000000ull);
+                arg.ts = uint64_t(uintptr_t(&ts));
             }
-        next_fd:;
         }
+        return int(syscall(__NR_io_uring_enter, fd_, to_submit, wait_nr, flags, &arg, sizeof(arg)));
     }
 
-    return 0;
+    // Обрабатывает все готовые завершения, начиная с перенесённых в backlog_;
+    // f может добавлять новые SQE (и тем самым пополнять backlog_)
+    template <class F>
+    void drain(F&& f) {
+        do {
+            std::vector<io_uring_cqe> stashed;
+            stashed.swap(backlog_);
+            for (const io_uring_cqe& cqe : stashed) f(cqe);
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            while (head != tail) {
+                io_uring_cqe cqe = cqes_[head & cq_mask_];
+                __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+                f(cqe);
+                if (head == tail) tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            }
+        } while (!backlog_.empty());
+    }
+
+private:
+    static constexpr int SQ_FULL_RETRIES = 8;
+
+    unsigned sq_free() const {
+        return sq_entries_ - (tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+    }
+
+    // Освобождает очередь завершений, копируя готовые завершения в backlog_
+    void stash_completions() {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) backlog_.push_back(cqes_[head & cq_mask_]);
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    int fd_ = -1;
+    char* ring_ = nullptr;
+    size_t ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned tail_ = 0;           // локальный хвост SQ, ещё не опубликованный ядру
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+    std::vector<io_uring_cqe> backlog_; // завершения, снятые с кольца при заполненной SQ
+};
+
+// Выражение в буфере сообщений
+struct PendingExpr {
+    uint64_t begin = 0;   // смещение текста в буфере (арене или буфере соединения)
+    uint32_t length = 0;  // длина без разделителя
+    bool error = false;   // ожидается ERR (деление на ноль)
+    long expected = 0;    // ожидаемый результат
+};
+
+// Значение ответа ERR в дайджестах и сравнениях
+constexpr long ERR_REPLY = long(0x8000000000455252ull);
+
+long expected_value(const PendingExpr& e) { return e.error ? ERR_REPLY : e.expected; }
+
+std::string expected_text(const PendingExpr& e) {
+    return e.error ? "ERR" : std::to_string(e.expected);
+}
+
+// Сообщение из нескольких подряд идущих выражений. Каждое выражение хранится
+// с разделителем, поэтому сообщение — непрерывный участок буфера.
+struct MessageView {
+    const char* data = nullptr;          // начало первого выражения
+    const PendingExpr* exprs = nullptr;  // выражения сообщения
+    uint32_t size = 0;                   // байт вместе с разделителями
+    uint32_t count = 0;                  // число выражений
+
+    std::string_view expr(size_t i) const {
+        return std::string_view(data + (exprs[i].begin - exprs[0].begin), exprs[i].length);
+    }
+};
+
+// Общая для всех потоков неизменяемая арена выражений: тексты подряд и массив
+// PendingExpr. Источником служит корпус (тексты остаются в отображённом файле)
+// или выражения, сгенерированные один раз при старте (--arena). Соединение
+// ссылается на участок арены и не владеет собственной копией сообщения.
+class MessageArena {
+public:
+    // Часть shard из shards корпуса: непрерывный участок, чтобы соседние
+    // выражения оставались соседними в памяти (для coalesce)
+    void build_from_corpus(const Corpus& corpus, int shard = 0, int shards = 1) {
+        size_t first = corpus.size() * size_t(shard) / size_t(shards);
+        size_t last = corpus.size() * size_t(shard + 1) / size_t(shards);
+        data_ = corpus.data();
+        exprs_.resize(last - first);
+        timestamps_.resize(last - first);
+        for (size_t i = first; i < last; ++i) {
+            exprs_[i - first].begin = corpus.offset(i);
+            exprs_[i - first].length = uint32_t(corpus.expr(i).size());
+            exprs_[i - first].expected = corpus.expected(i);
+            exprs_[i - first].error = corpus.expected_error(i);
+            timestamps_[i - first] = corpus.timestamp(i);
+        }
+        // Записанные интервалы отсчитываются от начала всего корпуса
+        base_timestamp_ = corpus.size() > 0 ? corpus.timestamp(0) : 0;
+    }
+
+    void generate(const Workload& w, int n, long count, uint64_t seed) {
+        FastRng rng(seed);
+        owned_.resize(size_t(count) * (max_expression_length(n, w) + 1));
+        exprs_.resize(size_t(count));
+        size_t pos = 0;
+        for (long i = 0; i < count; ++i) {
+            exprs_[i].begin = pos;
+            size_t len = make_expression(w, n, rng, &owned_[pos], exprs_[i].expected,
+                                         exprs_[i].error);
+            exprs_[i].length = uint32_t(len);
+            pos += len;
+            owned_[pos++] = ' ';
+        }
+        owned_.resize(pos);
+        owned_.shrink_to_fit();
+        data_ = owned_.data();
+    }
+
+    size_t size() const { return exprs_.size(); }
+    uint64_t timestamp(size_t i) const { return timestamps_.empty() ? 0 : timestamps_[i]; }
+    uint64_t base_timestamp() const { return base_timestamp_; }
+
+    // Сообщение из не более чем count выражений, начиная с first. Сообщение
+    // обрывается там, где тексты соседних записей не идут подряд.
+    MessageView message(size_t first, size_t count) const {
+        MessageView m;
+        m.data = data_ + exprs_[first].begin;
+        m.exprs = &exprs_[first];
+        size_t last = first;
+        while (last + 1 < first + count && last + 1 < exprs_.size() &&
+               exprs_[last + 1].begin == exprs_[last].begin + exprs_[last].length + 1) {
+            ++last;
+        }
+        m.count = uint32_t(last - first + 1);
+        m.size = uint32_t(exprs_[last].begin + exprs_[last].length + 1 - exprs_[first].begin);
+        return m;
+    }
+
+private:
+    const char* data_ = nullptr;
+    std::string owned_;                 // тексты сгенерированной арены
+    std::vector<PendingExpr> exprs_;
+    std::vector<uint64_t> timestamps_;  // записанные моменты отправки (корпус)
+    uint64_t base_timestamp_ = 0;       // момент первой записи всего корпуса
+};
+
+// Сообщение, сгенерированное для одного запроса (режим без арены)
+struct OwnedMessage {
+    std::string data;
+    std::vector<PendingExpr> exprs;
+};
+
+// Состояние соединения в его жизненном цикле
+enum class ConnState : uint8_t {
+    Free,       // слот не занят
+    Connecting, // ждём завершения неблокирующего connect()
+    Waiting,    // ждём записанного момента отправки (воспроизведение корпуса)
+    Sending,    // отправляем фрагменты сообщения
+    Receiving,  // ждём ответы сервера
+    Idle        // запросы выполнены, соединение удерживается (--hold)
+};
+
+// Максимальная длина ответа сервера без разделителя: long со знаком
+constexpr size_t MAX_REPLY = 20;
+
+// Компактное состояние одного соединения. Текст сообщения лежит в общей арене
+// (или в буфере owned, если выражения генерируются на каждый запрос), границы
+// фрагментов вычисляются по мере отправки, а от ответа хранится только
+// недочитанный хвост — так миллион соединений укладывается в ~100 МБ.
+struct Connection {
+    MessageView msg;                     // текущее сообщение
+    std::unique_ptr<OwnedMessage> owned; // буфер сообщения без арены
+    uint64_t started = 0;                // момент connect(), затем — начала отправки сообщения
+    uint64_t timer_at = 0;               // когда продолжить: отправка по записанному времени
+                                         // или следующий фрагмент после паузы
+    int fd = -1;
+    int id = 0;                          // порядковый номер соединения
+    int requests_left = 0;               // сколько выражений осталось отправить
+    uint32_t sent = 0;                   // сколько байт сообщения отправлено
+    uint32_t frag_end = 0;               // конец текущего фрагмента
+    uint32_t replied = 0;                // сколько ответов на сообщение получено
+    ConnState state = ConnState::Free;
+    uint8_t partial_len = 0;             // длина недочитанного ответа
+    uint8_t endpoint = 0;                // номер сервера в списке
+    uint32_t pending = 0;                // вклад в незавершённые запросы сервера (--balance)
+    uint16_t gen = 0;                    // поколение слота: отсеивает завершения io_uring
+                                         // для уже закрытого соединения
+    char partial[MAX_REPLY];             // недочитанный ответ
+};
+
+// Итоговые счётчики и гистограммы потока (задержки в наносекундах).
+// Счётчики можно читать из других потоков во время прогона, гистограммы — нет.
+struct Stats {
+    Counter connects_ok;
+    Counter connect_errors;
+    Counter io_errors;
+    Counter matches;
+    Counter mismatches;
+    Counter timeouts;            // запросы без ответа к истечению --timeout
+    Counter resets;              // запросы, оборванные EOF или ECONNRESET/EPIPE
+    Counter parse_failures;      // ответы, не разобранные ни как число, ни как ERR
+    Counter kernel_timed;        // ответы, чья задержка измерена по меткам ядра
+    Counter digest;              // сумма mix64(ответ сервера): не зависит от порядка ответов
+    Counter expected_digest;     // та же сумма по ожидаемым значениям
+    // Наибольшее число одновременно открытых соединений процесса (OpenGauge).
+    // merge() складывает пики: так сводятся итоги исполнителей --workers, которые
+    // в разных процессах и пиков в один момент не знают — сумма лишь верхняя оценка
+    uint64_t open_peak = 0;
+    Histogram connect_latency;   // от connect() до готовности сокета
+    Histogram request_latency;   // от первого фрагмента до ответа
+
+    void merge(const Stats& o) {
+        connects_ok.add(o.connects_ok.get());
+        connect_errors.add(o.connect_errors.get());
+        io_errors.add(o.io_errors.get());
+        matches.add(o.matches.get());
+        mismatches.add(o.mismatches.get());
+        timeouts.add(o.timeouts.get());
+        resets.add(o.resets.get());
+        parse_failures.add(o.parse_failures.get());
+        kernel_timed.add(o.kernel_timed.get());
+        digest.add(o.digest.get());
+        expected_digest.add(o.expected_digest.get());
+        open_peak += o.open_peak;
+        connect_latency.merge(o.connect_latency);
+        request_latency.merge(o.request_latency);
+    }
+
+    // Полученные ответы, включая неразобранные
+    uint64_t replies() const { return matches.get() + mismatches.get() + parse_failures.get(); }
+
+    // Передача итогов исполнителя координатору: строка счётчиков
+    // и по строке на гистограмму
+    void write(FILE* f) const {
+        for (const Counter* c : counters()) std::fprintf(f, "%llu ", (unsigned long long)c->get());
+        std::fprintf(f, "%llu\n", (unsigned long long)open_peak);
+        connect_latency.write(f);
+        request_latency.write(f);
+    }
+
+    // Добавляет итоги из строк write(); false — данные повреждены
+    bool read(const std::string& counts, const std::string& connect, const std::string& request) {
+        std::istringstream in(counts);
+        for (Counter* c : counters()) {
+            uint64_t v;
+            if (!(in >> v)) return false;
+            c->add(v);
+        }
+        uint64_t peak;
+        if (!(in >> peak)) return false;
+        open_peak += peak;
+        Histogram h;
+        if (!h.read(connect)) return false;
+        connect_latency.merge(h);
+        if (!h.read(request)) return false;
+        request_latency.merge(h);
+        return true;
+    }
+
+private:
+    std::vector<Counter*> counters() const {
+        Stats* s = const_cast<Stats*>(this);
+        return {&s->connects_ok, &s->connect_errors, &s->io_errors, &s->matches, &s->mismatches,
+                &s->timeouts, &s->resets, &s->parse_failures, &s->kernel_timed, &s->digest,
+                &s->expected_digest};
+    }
+};
+
+// Серверов в режиме A/B; у каждого свои курсор арены и временной ряд
+constexpr int MAX_ENDPOINTS = 2;
+// Размер арены, если в режиме A/B не задан ни корпус, ни --arena
+constexpr long AB_DEFAULT_ARENA = 100000;
+
+// Число открытых соединений всех потоков и его наибольшее значение
+struct OpenGauge {
+    std::atomic<long> now{0};
+    std::atomic<long> peak{0};
+
+    void opened() {
+        long n = now.fetch_add(1, std::memory_order_relaxed) + 1;
+        long p = peak.load(std::memory_order_relaxed);
+        while (n > p && !peak.compare_exchange_weak(p, n, std::memory_order_relaxed)) {}
+    }
+    void closed() { now.fetch_sub(1, std::memory_order_relaxed); }
+};
+
+// Состояние, общее для всех потоков клиента
+struct SharedState {
+    // sources — сколько рядов сдаёт каждую секунду: по одному на поток
+    // и на сервер, ряды серверов из --endpoints сливаются в общий
+    explicit SharedState(int sources)
+        : series{SeriesAggregator(sources), SeriesAggregator(sources)} {}
+
+    uint64_t start = 0;                      // общий момент старта прогона
+    // Следующее выражение арены; у каждого сервера свой курсор, поэтому
+    // A и B получают одну и ту же последовательность выражений
+    std::atomic<size_t> arena_pos[MAX_ENDPOINTS] = {};
+    std::atomic<uint64_t> source_port_rr{0}; // выбор локального адреса
+    std::atomic<int> mismatches_logged{0};   // сколько расхождений уже напечатано
+    SeriesAggregator series[MAX_ENDPOINTS];  // посекундный ряд всех потоков
+    std::atomic<int> burst_arrived{0};       // --burst: сколько потоков дошло до барьера
+    std::atomic<uint64_t> burst_release{0};  // --burst: момент общего залпа (0 — ещё не назначен)
+    // Незавершённые запросы каждого сервера по всем потокам (--balance least и p2c)
+    std::atomic<long> outstanding[MAX_BALANCED_ENDPOINTS] = {};
+    // Открытые соединения: всего и к каждому серверу. Пики потоков нельзя
+    // складывать — потоки достигают их в разное время
+    OpenGauge open;
+    OpenGauge open_to[MAX_BALANCED_ENDPOINTS];
+};
+
+// Запас между снятием барьера и залпом: спящие потоки успевают проснуться
+// и дождаться общего момента активным ожиданием
+constexpr uint64_t BURST_SETTLE_NS = 1000000;
+
+// Итоги залпа (--burst); моменты в шкале now_ns()
+struct BurstStats {
+    uint64_t released = 0;    // сообщений отправлено залпом
+    uint64_t answered = 0;    // из них получили все ответы
+    uint64_t release_at = 0;  // общий момент залпа
+    uint64_t first_send = 0;  // начало первой отправки
+    uint64_t last_send = 0;   // конец последней отправки
+    uint64_t last_reply = 0;  // последний ответ на сообщение залпа
+    Histogram latency;        // задержки ответов на сообщения залпа
+
+    void merge(const BurstStats& o) {
+        if (o.released == 0) return;
+        released += o.released;
+        answered += o.answered;
+        release_at = o.release_at;
+        first_send = first_send ? std::min(first_send, o.first_send) : o.first_send;
+        last_send = std::max(last_send, o.last_send);
+        last_reply = std::max(last_reply, o.last_reply);
+        latency.merge(o.latency);
+    }
+};
+
+// Метка таймера в epoll_event.data; остальные значения — номера слотов соединений
+constexpr uint64_t TIMER_TAG = UINT64_MAX;
+
+// Параметры движка io_uring
+constexpr unsigned URING_ENTRIES = 4096;           // размер очереди отправки
+constexpr int URING_RECV_BUFFERS = 1024;           // буферов приёма на поток
+constexpr unsigned URING_RECV_BUFFER_SIZE = 2048;
+constexpr uint16_t URING_BUFFER_GROUP = 1;
+
+// Операция в старших битах user_data; ниже — поколение и номер слота
+enum class UringOp : uint8_t { Connect = 1, Timeout, Send, Recv, Provide };
+
+// Серверы прогона по порядку: основной, затем B в режиме A/B или --endpoints
+std::vector<ServerAddr> server_list(const Options& opt) {
+    std::vector<ServerAddr> servers{ServerAddr{opt.server_addr, opt.server_port}};
+    if (!opt.ab_addr.empty()) servers.push_back(ServerAddr{opt.ab_addr, opt.ab_port});
+    servers.insert(servers.end(), opt.replicas.begin(), opt.replicas.end());
+    return servers;
+}
+
+// Генератор нагрузки: открывает соединения по расписанию и обслуживает их через epoll.
+// При --threads T каждый из T потоков работает со своим экземпляром и берёт
+// соединения с номерами index, index + T, ...
+class Client {
+public:
+    Client(const Options& opt, int index, const MessageArena* arena, bool replay,
+           CorpusWriter* recorder, SharedState& shared)
+        : opt_(opt), index_(index), rng_(make_rng(~opt.seed + index)),
+          gen_rng_(opt.seed ^ (uint64_t(index) * 0x9e3779b97f4a7c15ull)),
+          arena_(arena), replay_(replay), recorder_(recorder), shared_(shared) {
+        std::vector<ServerAddr> servers = server_list(opt);
+        ab_ = !opt.ab_addr.empty();
+        endpoints_ = int(servers.size());
+        ep_ = std::vector<Endpoint>(servers.size());
+        for (int e = 0; e < endpoints_; ++e) set_addr(ep_[e].addr, servers[e].addr, servers[e].port);
+        balancing_ = !ab_ && endpoints_ > 1 && opt.balance != Balance::RoundRobin;
+
+        // Доля этого потока в общих количествах и темпах. В режиме A/B
+        // соединения к A и B открываются поочерёдно, и всех величин вдвое больше.
+        churn_ = opt.churn_rate > 0;
+        target_ = share(per_endpoints(churn_ ? opt.churn_count : opt.connections));
+        rate_ = (churn_ ? opt.churn_rate : opt.ramp_rate) * (ab_ ? 2 : 1) / opt.threads;
+        max_open_ = std::max<long>(1, share(per_endpoints(opt.connections)));
+        if (replay_) corpus_base_ts_ = arena_->base_timestamp();
+        connect_timeout_.tv_sec = int64_t(opt.timeout_ns / 1000000000ull);
+        connect_timeout_.tv_nsec = int64_t(opt.timeout_ns % 1000000000ull);
+    }
+
+    int run() {
+        if (opt_.uring) {
+            ring_.reset(new Uring);
+            if (!ring_->init(URING_ENTRIES)) { perror("io_uring_setup"); return 1; }
+            provide_recv_buffers();
+        } else {
+            epoll_fd_ = epoll_create1(0);
+            if (epoll_fd_ < 0) { perror("epoll_create1"); return 1; }
+
+            // timerfd даёт точность лучше миллисекунды для расписания и пауз между фрагментами
+            timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+            if (timer_fd_ < 0) { perror("timerfd_create"); return 1; }
+            epoll_event tev{};
+            tev.events = EPOLLIN;
+            tev.data.u64 = TIMER_TAG;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &tev);
+        }
+
+        start_ = shared_.start;
+        // Окно измерения: статистика собирается только для событий внутри него
+        measure_from_ = start_;
+        measure_until_ = stop_at_ = UINT64_MAX;
+        if (opt_.duration > 0) {
+            measure_from_ = start_ + uint64_t(opt_.warmup * 1e9);
+            measure_until_ = measure_from_ + uint64_t(opt_.duration * 1e9);
+            stop_at_ = measure_until_ + uint64_t(opt_.cooldown * 1e9);
+        }
+        for (int e = 0; e < endpoints_; ++e) {
+            ep_[e].series.start(measure_from_, &shared_.series[ab_ ? e : 0]);
+        }
+
+        burst_waiting_ = opt_.burst;
+        if (ring_) uring_loop();
+        else epoll_loop();
+        // Поток без соединений всё равно проходит барьер, иначе его ждут остальные
+        if (burst_waiting_) arrive_at_barrier();
+
+        // По окончании прогона незавершённые запросы не учитываются
+        for (Connection& c : slab_) {
+            if (c.state != ConnState::Free) close(c.fd);
+        }
+        slab_.clear();
+
+        uint64_t end = std::min(now_ns(), measure_until_);
+        elapsed_ = end > measure_from_ ? end - measure_from_ : 0;
+        for (int e = 0; e < endpoints_; ++e) ep_[e].series.finish(std::max(end, measure_from_ + 1));
+        ring_.reset();
+        if (timer_fd_ >= 0) close(timer_fd_);
+        if (epoll_fd_ >= 0) close(epoll_fd_);
+        return 0;
+    }
+
+    const Stats& stats(int endpoint = 0) const { return ep_[endpoint].stats; }
+    const BurstStats& burst() const { return burst_; }
+    uint64_t elapsed_ns() const { return elapsed_; }
+
+private:
+    // Сервер со своими итогами и временным рядом
+    struct Endpoint {
+        sockaddr_in addr{};
+        long open = 0;           // открытых соединений к серверу
+        Stats stats;
+        TimeSeries series;
+    };
+    // Метки ядра соединения (--timestamps kernel), параллельно slab_
+    struct KernelStamps {
+        uint64_t bytes = 0;   // отправлено байт с включения меток (счёт OPT_ID)
+        uint64_t tx_ns = 0;   // метка отправки последнего байта сообщения (0 — ещё нет)
+        uint32_t tx_key = 0;  // номер этого байта в счёте OPT_ID
+    };
+
+    // Прогон продолжается, пока есть что открывать или ждать.
+    // Удерживаемые соединения живут до конца прогона.
+    bool running() const {
+        return ((opened_ < target_ && !source_exhausted()) || open_ > (opt_.hold ? 0 : idle_)) &&
+               now_ns() < stop_at_;
+    }
+
+    void epoll_loop() {
+        std::vector<epoll_event> events(MAX_EVENTS);
+        while (running()) {
+            open_due_connections();
+            run_timers();
+            // Истёкшие сроки могли закрыть последние соединения
+            if (!running()) break;
+            if (burst_waiting_ && burst_ready()) release_burst();
+
+            int n_events = epoll_wait(epoll_fd_, events.data(), MAX_EVENTS, wait_timeout_ms());
+            if (n_events < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+            for (int i = 0; i < n_events; ++i) {
+                if (events[i].data.u64 == TIMER_TAG) {
+                    uint64_t expirations;
+                    while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {}
+                    armed_at_ = 0;
+                    continue;
+                }
+                handle_event(uint32_t(events[i].data.u64), events[i].events);
+            }
+        }
+    }
+
+    // Цикл io_uring: все connect/send/recv, подготовленные за итерацию,
+    // уходят в ядро одним io_uring_enter вместе с ожиданием завершений
+    void uring_loop() {
+        while (running()) {
+            open_due_connections();
+            run_timers();
+            if (!running()) break;
+            if (burst_waiting_ && burst_ready()) release_burst();
+            retry_deferred();
+
+            // Перенесённые из кольца завершения ждать не нужно: они уже готовы
+            uint64_t next = next_deadline(), now = now_ns();
+            unsigned wait_nr = next > now && !ring_->backlogged() ? 1 : 0;
+            int ret = ring_->submit(wait_nr, next == UINT64_MAX ? UINT64_MAX : next - now);
+            if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+                perror("io_uring_enter");
+                break;
+            }
+            ring_->drain([this](const io_uring_cqe& cqe) { handle_completion(cqe); });
+        }
+    }
+
+    static void set_addr(sockaddr_in& a, const std::string& addr, int port) {
+        a.sin_family = AF_INET;
+        inet_pton(AF_INET, addr.c_str(), &a.sin_addr);
+        a.sin_port = htons(port);
+    }
+
+    // Количество с учётом режима A/B: каждому из двух серверов — по total.
+    // Серверы из --endpoints делят total между собой.
+    long per_endpoints(long total) const {
+        return total == LONG_MAX || !ab_ ? total : total * 2;
+    }
+
+    // Сервер для нового соединения. В режиме A/B соседние соединения потока
+    // идут к A и B по очереди, иначе выбор — по политике --balance
+    int pick_endpoint(int id) {
+        if (ab_) return (id - index_) / opt_.threads % 2;
+        if (endpoints_ == 1) return 0;
+        switch (opt_.balance) {
+            case Balance::RoundRobin:
+                return id % endpoints_;
+            case Balance::Least: {
+                // Из равных по загрузке сервер выбирается случайно, иначе
+                // пачка новых соединений уйдёт к одному и тому же
+                int best = 0;
+                long least = LONG_MAX;
+                uint32_t ties = 0;
+                for (int e = 0; e < endpoints_; ++e) {
+                    long load = outstanding(e);
+                    if (load < least) {
+                        best = e;
+                        least = load;
+                        ties = 1;
+                    } else if (load == least && rng_() % ++ties == 0) {
+                        best = e;
+                    }
+                }
+                return best;
+            }
+            case Balance::PowerOfTwo: {
+                int a = int(rng_() % uint32_t(endpoints_));
+                int b = int(rng_() % uint32_t(endpoints_ - 1));
+                if (b >= a) ++b;
+                return outstanding(b) < outstanding(a) ? b : a;
+            }
+        }
+        return 0;
+    }
+
+    long outstanding(int e) const {
+        return shared_.outstanding[e].load(std::memory_order_relaxed);
+    }
+
+    // Вклад соединения в незавершённые запросы его сервера: подключение
+    // в процессе (1) или отправленные выражения, на которые ещё нет ответа
+    void set_pending(Connection& c, uint32_t pending) {
+        if (!balancing_ || c.pending == pending) return;
+        shared_.outstanding[c.endpoint].fetch_add(long(pending) - long(c.pending),
+                                                  std::memory_order_relaxed);
+        c.pending = pending;
+    }
+
+    // Доля потока в общем количестве total
+    long share(long total) const {
+        if (total == LONG_MAX) return LONG_MAX;
+        return total / opt_.threads + (index_ < total % opt_.threads ? 1 : 0);
+    }
+
+    // Номер соединения, сквозной по всем потокам
+    int connection_id(long local) const {
+        return int(local * opt_.threads + index_);
+    }
+
+    // Сколько соединений должно быть открыто к моменту now по расписанию
+    long due_count(uint64_t now) const {
+        if (rate_ <= 0) return target_;
+        double due = double(now - start_) * 1e-9 * rate_ + 1;
+        return std::min<long>(target_, long(due));
+    }
+
+    // Корпус полностью роздан соединениям (сгенерированная арена не кончается)
+    bool source_exhausted() const {
+        if (!replay_) return false;
+        for (int e = 0; e < (ab_ ? 2 : 1); ++e) {
+            if (shared_.arena_pos[e].load(std::memory_order_relaxed) < arena_->size()) return false;
+        }
+        return true;
+    }
+
+    void open_due_connections() {
+        long due = due_count(now_ns());
+        while (opened_ < due && !source_exhausted()) {
+            // В режиме churn число одновременно открытых соединений ограничено
+            if (churn_ && open_ >= max_open_) break;
+            open_connection(connection_id(opened_++));
+        }
+    }
+
+    // Ближайшее запланированное действие: открытие соединения, отправка по
+    // записанному времени или следующий фрагмент (0 — уже пора, UINT64_MAX — нет)
+    uint64_t next_deadline() const {
+        uint64_t next = UINT64_MAX;
+        if (opened_ < target_ && !source_exhausted() && !(churn_ && open_ >= max_open_)) {
+            if (rate_ <= 0) return 0;
+            next = start_ + uint64_t(double(opened_) / rate_ * 1e9);
+        }
+        if (!timers_.empty()) next = std::min(next, timers_.top().first);
+        if (!deadlines_.empty()) next = std::min(next, deadlines_.top().first);
+        return std::min(next, stop_at_);
+    }
+
+    // Таймаут epoll_wait до ближайшего запланированного действия.
+    // Дальние сроки отслеживает timerfd, epoll_wait тогда ждёт без таймаута.
+    int wait_timeout_ms() {
+        uint64_t next = next_deadline();
+        if (next == UINT64_MAX) return -1;
+        if (next <= now_ns()) return 0;
+        if (next != armed_at_) {
+            itimerspec its{};
+            its.it_value.tv_sec = time_t(next / 1000000000ull);
+            its.it_value.tv_nsec = long(next % 1000000000ull);
+            timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+            armed_at_ = next;
+        }
+        return -1;
+    }
+
+    void schedule(uint32_t slot, Connection& c, uint64_t at) {
+        c.timer_at = at;
+        timers_.emplace(at, slot);
+    }
+
+    // Продолжает соединения, чей срок наступил. Устаревшие записи
+    // (соединение закрыто или перепланировано) пропускаются.
+    void run_timers() {
+        uint64_t now = now_ns();
+        while (!timers_.empty() && timers_.top().first <= now) {
+            auto [at, slot] = timers_.top();
+            timers_.pop();
+            Connection& c = slab_[slot];
+            if (c.state == ConnState::Free || c.timer_at != at) continue;
+            c.timer_at = 0;
+            if (c.state == ConnState::Waiting) begin_send(slot, c);
+            else if (c.state == ConnState::Sending) send_fragments(slot, c);
+        }
+        run_deadlines(now);
+    }
+
+    // Ставит проверку срока текущего connect или сообщения. У слота в очереди
+    // не больше одной записи: сработав раньше срока (слот успел начать новое
+    // сообщение), она переставляется на новый срок. Так очередь не растёт
+    // с темпом запросов.
+    void arm_deadline(uint32_t slot, const Connection& c) {
+        if (opt_.timeout_ns == 0 || deadline_armed_[slot]) return;
+        deadline_armed_[slot] = 1;
+        deadlines_.emplace(c.started + opt_.timeout_ns, slot);
+    }
+
+    // Закрывает соединения, не дождавшиеся connect или ответа за --timeout.
+    // Неотвеченные выражения сообщения учитываются как таймауты с задержкой,
+    // равной времени ожидания, и попадают в хвост распределения.
+    void run_deadlines(uint64_t now) {
+        while (!deadlines_.empty() && deadlines_.top().first <= now) {
+            uint32_t slot = deadlines_.top().second;
+            deadlines_.pop();
+            deadline_armed_[slot] = 0;
+            Connection& c = slab_[slot];
+            // connect через io_uring ограничен связанным таймаутом
+            bool connecting = c.state == ConnState::Connecting && !ring_;
+            if (!connecting && c.state != ConnState::Sending && c.state != ConnState::Receiving) {
+                continue;
+            }
+            if (c.started + opt_.timeout_ns > now) {
+                arm_deadline(slot, c);
+                continue;
+            }
+            if (connecting) {
+                if (!opt_.quiet) {
+                    std::cerr << "[Conn " << c.id << "] connect: " << strerror(ETIMEDOUT) << std::endl;
+                }
+                count_connect_error(endpoint(c));
+            } else {
+                if (!opt_.quiet) {
+                    std::cerr << "[Conn " << c.id << "] Timeout: " << c.msg.count - c.replied
+                              << " replies missing" << std::endl;
+                }
+                count_timeouts(endpoint(c), c.started, now - c.started, c.msg.count - c.replied);
+            }
+            close_connection(slot);
+        }
+    }
+
+    // Все соединения потока открыты и ждут залпа (не открывшиеся уже закрыты)
+    bool burst_ready() const {
+        return (opened_ >= target_ || source_exhausted()) && open_ == long(burst_slots_.size());
+    }
+
+    // Поток пришёл к барьеру; последний пришедший назначает момент залпа
+    void arrive_at_barrier() {
+        burst_waiting_ = false;
+        if (shared_.burst_arrived.fetch_add(1) + 1 == opt_.threads) {
+            shared_.burst_release.store(now_ns() + BURST_SETTLE_NS);
+        }
+    }
+
+    // Барьер между потоками, затем первые сообщения всех соединений потока
+    // уходят подряд, каждое одним вызовом send
+    void release_burst() {
+        arrive_at_barrier();
+        uint64_t release;
+        while ((release = shared_.burst_release.load()) == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        while (now_ns() < release) {}
+
+        burst_.release_at = release;
+        burst_.first_send = now_ns();
+        in_burst_ = true;
+        for (uint32_t slot : burst_slots_) {
+            Connection& c = slab_[slot];
+            if (c.state != ConnState::Waiting) continue;
+            burst_.released++;
+            begin_send(slot, c);
+        }
+        in_burst_ = false;
+        if (ring_) ring_->submit(0, 0);
+        burst_.last_send = now_ns();
+        std::vector<uint32_t>().swap(burst_slots_);
+    }
+
+    // Сообщение отправлено залпом
+    bool in_burst(const Connection& c) const {
+        return burst_.last_send != 0 && c.started <= burst_.last_send;
+    }
+
+    // Свободный слот в пуле соединений
+    uint32_t alloc_slot() {
+        if (!free_slots_.empty()) {
+            uint32_t slot = free_slots_.back();
+            free_slots_.pop_back();
+            return slot;
+        }
+        slab_.emplace_back();
+        deadline_armed_.push_back(0);
+        if (opt_.kernel_timestamps) stamps_.emplace_back();
+        return uint32_t(slab_.size() - 1);
+    }
+
+    void open_connection(int id) {
+        int endpoint = pick_endpoint(id);
+        Endpoint& ep = ep_[endpoint];
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            if (!opt_.quiet) perror("socket");
+            count_connect_error(ep);
+            return;
+        }
+        // io_uring сам дожидается готовности сокета, O_NONBLOCK нужен только epoll
+        if (!ring_) set_nonblocking(fd);
+        // Без Nagle каждый фрагмент уходит отдельным сегментом
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        // Несколько локальных адресов снимают предел в ~28 тыс. эфемерных портов
+        // на адрес. IP_BIND_ADDRESS_NO_PORT откладывает выбор порта до connect(),
+        // чтобы ядро подбирало его по полному четвёрному кортежу.
+        if (!opt_.source_addrs.empty()) {
+            setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+            sockaddr_in local{};
+            local.sin_family = AF_INET;
+            uint64_t k = shared_.source_port_rr.fetch_add(1, std::memory_order_relaxed);
+            local.sin_addr = opt_.source_addrs[k % opt_.source_addrs.size()];
+            if (bind(fd, (sockaddr*)&local, sizeof(local)) < 0) {
+                if (!opt_.quiet) perror("bind");
+                count_connect_error(ep);
+                close(fd);
+                return;
+            }
+        }
+
+        uint64_t started = now_ns();
+        if (!ring_ && connect(fd, (sockaddr*)&ep.addr, sizeof(ep.addr)) < 0 &&
+            errno != EINPROGRESS) {
+            if (!opt_.quiet) {
+                std::cerr << "[Conn " << id << "] connect: " << strerror(errno) << std::endl;
+            }
+            count_connect_error(ep);
+            close(fd);
+            return;
+        }
+
+        // connect и связанный таймаут должны попасть в очередь вместе
+        if (ring_ && !ring_->reserve(opt_.timeout_ns > 0 ? 2 : 1)) {
+            if (!opt_.quiet) std::cerr << "[Conn " << id << "] io_uring submission queue is full" << std::endl;
+            count_connect_error(ep);
+            close(fd);
+            return;
+        }
+
+        uint32_t slot = alloc_slot();
+        Connection& c = slab_[slot];
+        c.fd = fd;
+        c.id = id;
+        c.state = ConnState::Connecting;
+        c.started = started;
+        c.requests_left = opt_.requests;
+        c.timer_at = 0;
+        c.partial_len = 0;
+        c.endpoint = uint8_t(endpoint);
+        set_pending(c, 1);
+        if (!ring_) arm_deadline(slot, c);
+
+        if (ring_) {
+            // connect со связанным таймаутом: по его истечении connect отменяется
+            io_uring_sqe* sqe = ring_->sqe();
+            sqe->opcode = IORING_OP_CONNECT;
+            sqe->fd = fd;
+            sqe->addr = uint64_t(uintptr_t(&ep.addr));
+            sqe->off = sizeof(ep.addr);
+            sqe->user_data = uring_tag(UringOp::Connect, slot, c);
+            if (opt_.timeout_ns > 0) {
+                sqe->flags = IOSQE_IO_LINK;
+                sqe = ring_->sqe();
+                sqe->opcode = IORING_OP_LINK_TIMEOUT;
+                sqe->fd = -1;
+                sqe->addr = uint64_t(uintptr_t(&connect_timeout_));
+                sqe->len = 1;
+                sqe->user_data = uring_tag(UringOp::Timeout, slot, c);
+            }
+        } else {
+            // Завершение connect() сообщается событием EPOLLOUT (или EPOLLERR)
+            epoll_event ev{};
+            ev.data.u64 = slot;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+        open_++;
+        ep.open++;
+        shared_.open.opened();
+        shared_.open_to[endpoint].opened();
+        if (!opt_.quiet) std::cout << "[Conn " << id << "] Opened fd=" << fd << std::endl;
+    }
+
+    // Событие, начавшееся в момент t, попадает в окно измерения
+    bool in_window(uint64_t t) const {
+        return t >= measure_from_ && t < measure_until_;
+    }
+
+    // Учёт событий окна измерения сразу в итоговых счётчиках и во временном ряду.
+    // Соединения и запросы относятся к окну по моменту своего начала.
+    Endpoint& endpoint(const Connection& c) { return ep_[c.endpoint]; }
+
+    void count_connect(Endpoint& ep, uint64_t started, uint64_t latency) {
+        if (!in_window(started)) return;
+        ep.stats.connects_ok.add();
+        ep.stats.connect_latency.record(latency);
+        ep.series.at(started).connects++;
+    }
+
+    void count_connect_error(Endpoint& ep) {
+        uint64_t now = now_ns();
+        if (!in_window(now)) return;
+        ep.stats.connect_errors.add();
+        ep.series.at(now).connect_errors++;
+    }
+
+    void count_io_error(Endpoint& ep) {
+        uint64_t now = now_ns();
+        if (!in_window(now)) return;
+        ep.stats.io_errors.add();
+        ep.series.at(now).io_errors++;
+    }
+
+    void count_parse_failure(Endpoint& ep) {
+        uint64_t now = now_ns();
+        if (!in_window(now)) return;
+        ep.stats.parse_failures.add();
+        ep.series.at(now).parse_failures++;
+    }
+
+    // count выражений сообщения, начатого в started, остались без ответа за latency
+    void count_timeouts(Endpoint& ep, uint64_t started, uint64_t latency, uint32_t count) {
+        if (!in_window(started) || count == 0) return;
+        uint64_t now = std::min(now_ns(), measure_until_ - 1);
+        ep.stats.timeouts.add(count);
+        for (uint32_t i = 0; i < count; ++i) ep.stats.request_latency.record(latency);
+        ep.series.record_timeout(now, latency, count);
+    }
+
+    void count_resets(Endpoint& ep, uint64_t started, uint32_t count) {
+        if (!in_window(started) || count == 0) return;
+        uint64_t now = std::min(now_ns(), measure_until_ - 1);
+        ep.stats.resets.add(count);
+        ep.series.at(now).resets += count;
+    }
+
+    // false — ответ вне окна измерения и не учтён. Неразобранный ответ (parsed
+    // = false) входит в дайджест, но учитывается отдельно от расхождений.
+    bool count_reply(Endpoint& ep, uint64_t started, uint64_t latency, long server_res,
+                     long expected, bool parsed) {
+        if (!in_window(started)) return false;
+        uint64_t now = std::min(now_ns(), measure_until_ - 1);
+        ep.stats.request_latency.record(latency);
+        ep.series.record_latency(now, latency);
+        ep.stats.digest.add(mix64(uint64_t(server_res)));
+        ep.stats.expected_digest.add(mix64(uint64_t(expected)));
+        if (!parsed) {
+            ep.stats.parse_failures.add();
+            ep.series.at(now).parse_failures++;
+        } else if (server_res == expected) {
+            ep.stats.matches.add();
+        } else {
+            ep.stats.mismatches.add();
+            ep.series.at(now).mismatches++;
+        }
+        return true;
+    }
+
+    // Соединение оборвалось с ошибкой err (0 — сервер закрыл его). Конец потока
+    // и сброс до получения всех ответов сообщения учитываются как обрывы
+    // запросов, прочие ошибки — как ошибки ввода-вывода. У удерживаемого
+    // соединения запросов нет, и его закрытие сервером штатное.
+    void connection_lost(uint32_t slot, Connection& c, int err) {
+        if (c.state != ConnState::Idle) {
+            if (err == 0 || err == ECONNRESET || err == EPIPE) {
+                count_resets(endpoint(c), c.started, c.msg.count - c.replied);
+            } else {
+                count_io_error(endpoint(c));
+            }
+        }
+        close_connection(slot);
+    }
+
+    void close_connection(uint32_t slot) {
+        Connection& c = slab_[slot];
+        if (c.state == ConnState::Idle) idle_--;
+        // Незавершённые операции io_uring держат сокет открытым;
+        // shutdown завершает их, а новое поколение слота отсеет их результаты
+        if (ring_) shutdown(c.fd, SHUT_RDWR);
+        close(c.fd);
+        c.gen++;
+        c.state = ConnState::Free;
+        c.owned.reset();
+        c.msg = MessageView{};
+        set_pending(c, 0);
+        endpoint(c).open--;
+        open_--;
+        shared_.open.closed();
+        shared_.open_to[c.endpoint].closed();
+        free_slots_.push_back(slot);
+    }
+
+    void set_events(uint32_t slot, int fd, uint32_t events) {
+        epoll_event mod{};
+        mod.data.u64 = slot;
+        mod.events = events | EPOLLET;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &mod);
+    }
+
+    // Ждать ответы: epoll — подписаться на EPOLLIN, io_uring — запустить recv.
+    // Пока обрабатывается завершение recv этого же слота, новый recv
+    // запускать не нужно: его перезапустит handle_completion.
+    void await_replies(uint32_t slot, Connection& c) {
+        if (!ring_) {
+            set_events(slot, c.fd, EPOLLIN);
+        } else if (slot != recv_in_progress_) {
+            submit_recv(slot, c);
+        }
+    }
+
+    uint64_t uring_tag(UringOp op, uint32_t slot, const Connection& c) const {
+        return uint64_t(op) << 56 | uint64_t(c.gen) << 32 | slot;
+    }
+
+    // Буферы для recv выбирает ядро из общей группы, поэтому память под
+    // приём не зависит от числа соединений
+    void provide_recv_buffers() {
+        recv_buffers_.resize(size_t(URING_RECV_BUFFERS) * URING_RECV_BUFFER_SIZE);
+        io_uring_sqe* sqe = ring_->sqe(); // кольцо ещё пустое
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = URING_RECV_BUFFERS;
+        sqe->addr = uint64_t(uintptr_t(recv_buffers_.data()));
+        sqe->len = URING_RECV_BUFFER_SIZE;
+        sqe->off = 0;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = uint64_t(UringOp::Provide) << 56;
+    }
+
+    // Возвращает буфер bid в группу после разбора принятых данных
+    void return_recv_buffer(uint16_t bid) {
+        io_uring_sqe* sqe = ring_->sqe();
+        if (!sqe) {
+            unreturned_.push_back(bid);
+            return;
+        }
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = 1;
+        sqe->addr = uint64_t(uintptr_t(recv_buffers_.data() + size_t(bid) * URING_RECV_BUFFER_SIZE));
+        sqe->len = URING_RECV_BUFFER_SIZE;
+        sqe->off = bid;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = uint64_t(UringOp::Provide) << 56;
+    }
+
+    // Если очередь отправки не освободилась, операция откладывается до следующей
+    // итерации цикла (retry_deferred), когда завершения будут обработаны
+    void submit_send(uint32_t slot, Connection& c) {
+        io_uring_sqe* sqe = ring_->sqe();
+        if (!sqe) {
+            unsent_.emplace_back(slot, c.gen);
+            return;
+        }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = c.fd;
+        sqe->addr = uint64_t(uintptr_t(c.msg.data + c.sent));
+        sqe->len = c.frag_end - c.sent;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = uring_tag(UringOp::Send, slot, c);
+    }
+
+    void submit_recv(uint32_t slot, Connection& c) {
+        io_uring_sqe* sqe = ring_->sqe();
+        if (!sqe) {
+            starved_.emplace_back(slot, c.gen);
+            return;
+        }
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = c.fd;
+        sqe->len = URING_RECV_BUFFER_SIZE;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_BUFFER_GROUP;
+        sqe->user_data = uring_tag(UringOp::Recv, slot, c);
+    }
+
+    // Отложенные операции перезапускаются на следующей итерации: recv, которым
+    // не хватило буферов (ENOBUFS), а также send, recv и возврат буферов, для
+    // которых не нашлось места в очереди отправки
+    void retry_deferred() {
+        std::vector<uint16_t> unreturned;
+        unreturned.swap(unreturned_);
+        for (uint16_t bid : unreturned) return_recv_buffer(bid);
+        std::vector<std::pair<uint32_t, uint16_t>> unsent;
+        unsent.swap(unsent_);
+        for (auto [slot, gen] : unsent) {
+            Connection& c = slab_[slot];
+            if (c.gen == gen && c.state == ConnState::Sending) submit_send(slot, c);
+        }
+        std::vector<std::pair<uint32_t, uint16_t>> starved;
+        starved.swap(starved_);
+        for (auto [slot, gen] : starved) {
+            Connection& c = slab_[slot];
+            if (c.gen == gen && (c.state == ConnState::Receiving || c.state == ConnState::Idle)) {
+                submit_recv(slot, c);
+            }
+        }
+    }
+
+    void handle_completion(const io_uring_cqe& cqe) {
+        UringOp op = UringOp(cqe.user_data >> 56);
+        uint32_t slot = uint32_t(cqe.user_data);
+        uint16_t gen = uint16_t(cqe.user_data >> 32);
+        int bid = cqe.flags & IORING_CQE_F_BUFFER ? int(cqe.flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+        if (op == UringOp::Provide || op == UringOp::Timeout) {
+            if (op == UringOp::Provide && cqe.res < 0) {
+                std::cerr << "IORING_OP_PROVIDE_BUFFERS: " << strerror(-cqe.res) << std::endl;
+            }
+            return;
+        }
+        Connection* cp = slot < slab_.size() ? &slab_[slot] : nullptr;
+        if (!cp || cp->gen != gen || cp->state == ConnState::Free) {
+            // Результат операции уже закрытого соединения
+            if (bid >= 0) return_recv_buffer(uint16_t(bid));
+            return;
+        }
+        Connection& c = *cp;
+
+        if (op == UringOp::Connect) {
+            if (cqe.res < 0) {
+                if (!opt_.quiet) {
+                    // Отменённый связанным таймаутом connect завершается с ECANCELED
+                    std::cerr << "[Conn " << c.id << "] connect: "
+                              << strerror(cqe.res == -ECANCELED ? ETIMEDOUT : -cqe.res) << std::endl;
+                }
+                count_connect_error(endpoint(c));
+                close_connection(slot);
+                return;
+            }
+            count_connect(endpoint(c), c.started, now_ns() - c.started);
+            issue_request(slot, c);
+        }
+        else if (op == UringOp::Send) {
+            if (cqe.res <= 0) {
+                connection_lost(slot, c, -cqe.res);
+                return;
+            }
+            c.sent += uint32_t(cqe.res);
+            if (c.sent < c.frag_end) {
+                submit_send(slot, c);
+            } else if (c.sent == c.msg.size) {
+                // Все фрагменты отправлены — ждём только ответы
+                c.state = ConnState::Receiving;
+                await_replies(slot, c);
+            } else {
+                c.frag_end = next_fragment_end(c.sent, c.msg.size, opt_.fragment, rng_);
+                // Пауза перед следующим фрагментом
+                if (opt_.fragment.delay_ns > 0) schedule(slot, c, now_ns() + opt_.fragment.delay_ns);
+                else submit_send(slot, c);
+            }
+        }
+        else if (op == UringOp::Recv) {
+            if (cqe.res == -ENOBUFS) {
+                starved_.emplace_back(slot, gen);
+                return;
+            }
+            if (cqe.res <= 0) {
+                if (bid >= 0) return_recv_buffer(uint16_t(bid));
+                connection_lost(slot, c, -cqe.res);
+                return;
+            }
+            recv_in_progress_ = slot;
+            bool open = consume_replies(slot, c, recv_buffers_.data() +
+                                        size_t(bid) * URING_RECV_BUFFER_SIZE, size_t(cqe.res));
+            recv_in_progress_ = UINT32_MAX;
+            return_recv_buffer(uint16_t(bid));
+            if (open && (c.state == ConnState::Receiving || c.state == ConnState::Idle)) {
+                submit_recv(slot, c);
+            }
+        }
+    }
+
+    void handle_event(uint32_t slot, uint32_t evs) {
+        Connection& c = slab_[slot];
+        if (c.state == ConnState::Free) return;
+
+        if (c.state == ConnState::Connecting) {
+            if (!(evs & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+            // Неблокирующий connect() завершён — проверяем его результат
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+            if (err != 0) {
+                if (!opt_.quiet) {
+                    std::cerr << "[Conn " << c.id << "] connect: " << strerror(err) << std::endl;
+                }
+                count_connect_error(endpoint(c));
+                close_connection(slot);
+                return;
+            }
+            count_connect(endpoint(c), c.started, now_ns() - c.started);
+            if (opt_.kernel_timestamps) enable_timestamps(slot, c);
+            if (!issue_request(slot, c)) return;
+        }
+        else if (c.state == ConnState::Sending && (evs & EPOLLOUT) && c.timer_at == 0) {
+            if (!send_fragments(slot, c)) return;
+        }
+
+        if ((c.state == ConnState::Receiving || c.state == ConnState::Idle) &&
+            (evs & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+            receive_replies(slot, c);
+        }
+    }
+
+    // Выбирает следующее сообщение соединения: участок общей арены или
+    // новые выражения в собственном буфере. false — выражения закончились.
+    bool next_message(Connection& c, uint64_t& send_at) {
+        size_t want = size_t(std::min(opt_.fragment.coalesce, c.requests_left));
+        if (want == 0) return false;
+        if (arena_) {
+            std::atomic<size_t>& pos = shared_.arena_pos[ab_ ? c.endpoint : 0];
+            size_t first = pos.fetch_add(want, std::memory_order_relaxed);
+            if (replay_) {
+                if (first >= arena_->size()) return false;
+            } else {
+                first %= arena_->size();
+            }
+            c.msg = arena_->message(first, want);
+            if (replay_ && opt_.replay_recorded) {
+                send_at = start_ + (arena_->timestamp(first) - corpus_base_ts_);
+            }
+        } else {
+            // Выражения пишутся прямо в буфер сообщения, ответы считаются попутно
+            if (!c.owned) c.owned.reset(new OwnedMessage);
+            OwnedMessage& m = *c.owned;
+            m.data.clear();
+            m.exprs.resize(want);
+            for (PendingExpr& e : m.exprs) {
+                e.begin = m.data.size();
+                m.data.resize(e.begin + max_expression_length(opt_.n, opt_.workload));
+                e.length = uint32_t(make_expression(opt_.workload, opt_.n, gen_rng_,
+                                                    &m.data[e.begin], e.expected, e.error));
+                m.data.resize(e.begin + e.length);
+                // Добавляем пробел в конце как разделитель
+                m.data.push_back(' ');
+            }
+            c.msg.data = m.data.data();
+            c.msg.exprs = m.exprs.data();
+            c.msg.size = uint32_t(m.data.size());
+            c.msg.count = uint32_t(want);
+        }
+        c.requests_left -= int(c.msg.count);
+        if (!opt_.quiet) {
+            for (uint32_t i = 0; i < c.msg.count; ++i) {
+                std::cout << "[Conn " << c.id << "] Expr: " << c.msg.expr(i)
+                          << " Expected: " << expected_text(c.msg.exprs[i]) << std::endl;
+            }
+        }
+        return true;
+    }
+
+    // Запускает следующее сообщение соединения. Если выражений больше нет,
+    // соединение закрывается или удерживается (--hold). false — соединение закрыто.
+    bool issue_request(uint32_t slot, Connection& c) {
+        c.replied = 0;
+        set_pending(c, 0);
+        uint64_t send_at = 0;
+        if (!next_message(c, send_at)) {
+            if (opt_.hold) {
+                c.state = ConnState::Idle;
+                idle_++;
+                await_replies(slot, c);
+                return true;
+            }
+            close_connection(slot);
+            return false;
+        }
+        if (burst_waiting_) {
+            // Первое сообщение ждёт общего залпа
+            c.state = ConnState::Waiting;
+            burst_slots_.push_back(slot);
+            return true;
+        }
+        if (send_at > now_ns()) {
+            c.state = ConnState::Waiting;
+            schedule(slot, c, send_at);
+            return true;
+        }
+        return begin_send(slot, c);
+    }
+
+    // Начинает отправку сообщения
+    bool begin_send(uint32_t slot, Connection& c) {
+        c.sent = 0;
+        c.frag_end = in_burst_ ? c.msg.size : next_fragment_end(0, c.msg.size, opt_.fragment, rng_);
+        c.state = ConnState::Sending;
+        c.started = now_ns();
+        set_pending(c, c.msg.count);
+        arm_deadline(slot, c);
+        if (opt_.kernel_timestamps) {
+            KernelStamps& st = stamps_[slot];
+            st.tx_key = uint32_t(st.bytes + c.msg.size - 1);
+            st.tx_ns = 0;
+        }
+        if (recorder_) {
+            for (uint32_t i = 0; i < c.msg.count; ++i) {
+                recorder_->add(c.msg.expr(i), c.msg.exprs[i].expected, c.msg.exprs[i].error,
+                               c.started - start_);
+            }
+        }
+        return send_fragments(slot, c);
+    }
+
+    // Отправляет оставшиеся фрагменты; false — соединение закрыто из-за ошибки
+    bool send_fragments(uint32_t slot, Connection& c) {
+        // io_uring: текущий фрагмент уходит одним SEND, продолжение — в handle_completion
+        if (ring_) {
+            submit_send(slot, c);
+            return true;
+        }
+        while (c.sent < c.msg.size) {
+            ssize_t sent = send_fragment(slot, c);
+            if (sent > 0) {
+                c.sent += uint32_t(sent);
+                if (c.sent < c.frag_end || c.sent == c.msg.size) continue;
+                c.frag_end = next_fragment_end(c.sent, c.msg.size, opt_.fragment, rng_);
+                // Пауза перед следующим фрагментом
+                if (opt_.fragment.delay_ns > 0) {
+                    schedule(slot, c, now_ns() + opt_.fragment.delay_ns);
+                    return true;
+                }
+            } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // Дождёмся EPOLLOUT
+                set_events(slot, c.fd, EPOLLIN | EPOLLOUT);
+                return true;
+            } else {
+                connection_lost(slot, c, sent == 0 ? 0 : errno);
+                return false;
+            }
+        }
+        // Все фрагменты отправлены — ждём только ответы
+        c.state = ConnState::Receiving;
+        await_replies(slot, c);
+        return true;
+    }
+
+    // Отправляет текущий фрагмент. С метками ядра метку отправки
+    // запрашивает только вызов, в который входит последний байт сообщения.
+    ssize_t send_fragment(uint32_t slot, Connection& c) {
+        const char* p = c.msg.data + c.sent;
+        size_t len = c.frag_end - c.sent;
+        if (!opt_.kernel_timestamps) return send(c.fd, p, len, MSG_NOSIGNAL);
+
+        iovec iov{const_cast<char*>(p), len};
+        msghdr mh{};
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint32_t))] = {};
+        if (c.frag_end == c.msg.size) {
+            mh.msg_control = control;
+            mh.msg_controllen = sizeof(control);
+            cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SO_TIMESTAMPING;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+            uint32_t flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+            std::memcpy(CMSG_DATA(cm), &flags, sizeof(flags));
+        }
+        ssize_t sent = sendmsg(c.fd, &mh, MSG_NOSIGNAL);
+        if (sent > 0) stamps_[slot].bytes += uint64_t(sent);
+        return sent;
+    }
+
+    // Метки ядра включаются после connect: счётчик байт OPT_ID отсчитывается
+    // от первого байта, отправленного после этого вызова
+    void enable_timestamps(uint32_t slot, Connection& c) {
+        stamps_[slot] = KernelStamps{};
+        uint32_t flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                         SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(c.fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0 &&
+            !opt_.quiet) {
+            perror("setsockopt(SO_TIMESTAMPING)");
+        }
+    }
+
+    static uint64_t timespec_ns(const timespec& ts) {
+        return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+    }
+
+    // Забирает метки отправки из очереди ошибок сокета и запоминает метку
+    // последнего байта текущего сообщения
+    void read_tx_stamps(uint32_t slot, Connection& c) {
+        KernelStamps& st = stamps_[slot];
+        while (true) {
+            alignas(cmsghdr) char control[256];
+            msghdr mh{};
+            mh.msg_control = control;
+            mh.msg_controllen = sizeof(control);
+            if (recvmsg(c.fd, &mh, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) return;
+            const scm_timestamping* ts = nullptr;
+            const sock_extended_err* ee = nullptr;
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+                if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+                    ts = reinterpret_cast<const scm_timestamping*>(CMSG_DATA(cm));
+                } else if (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) {
+                    ee = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+                }
+            }
+            if (ts && ee && ee->ee_origin == SO_EE_ORIGIN_TIMESTAMPING && ee->ee_data == st.tx_key) {
+                st.tx_ns = timespec_ns(ts->ts[0]);
+            }
+        }
+    }
+
+    // recv с меткой приёма ядра в rx_stamp_ns_
+    ssize_t receive_stamped(int fd, char* buf, size_t size) {
+        iovec iov{buf, size};
+        alignas(cmsghdr) char control[256];
+        msghdr mh{};
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control;
+        mh.msg_controllen = sizeof(control);
+        ssize_t count = recvmsg(fd, &mh, 0);
+        rx_stamp_ns_ = 0;
+        for (cmsghdr* cm = CMSG_FIRSTHDR(&mh); count > 0 && cm; cm = CMSG_NXTHDR(&mh, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPING) {
+                rx_stamp_ns_ = timespec_ns(reinterpret_cast<const scm_timestamping*>(CMSG_DATA(cm))->ts[0]);
+            }
+        }
+        return count;
+    }
+
+    void receive_replies(uint32_t slot, Connection& c) {
+        char buf[4096];
+        while (true) {
+            ssize_t count = opt_.kernel_timestamps ? receive_stamped(c.fd, buf, sizeof(buf))
+                                                   : recv(c.fd, buf, sizeof(buf), 0);
+            if (count > 0) {
+                if (!consume_replies(slot, c, buf, size_t(count))) return;
+            } else if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else if (count < 0 && errno == EINTR) {
+                continue;
+            } else {
+                // Конец потока или ошибка: ответов на это соединение больше не будет
+                connection_lost(slot, c, count == 0 ? 0 : errno);
+                return;
+            }
+        }
+    }
+
+    // Разбирает ответы из принятых данных. Ответы приходят по порядку выражений,
+    // разделитель — пробел. false — соединение закрыто.
+    bool consume_replies(uint32_t slot, Connection& c, const char* p, size_t n) {
+        while (n > 0) {
+            const char* sp = static_cast<const char*>(std::memchr(p, ' ', n));
+            size_t chunk = sp ? size_t(sp - p) : n;
+            if (c.partial_len + chunk > MAX_REPLY || c.state != ConnState::Receiving) {
+                // Слишком длинный ответ или лишние данные — протокол нарушен
+                count_parse_failure(endpoint(c));
+                close_connection(slot);
+                return false;
+            }
+            std::memcpy(c.partial + c.partial_len, p, chunk);
+            c.partial_len += uint8_t(chunk);
+            if (!sp) return true;
+            p += chunk + 1;
+            n -= chunk + 1;
+
+            std::string_view resp(c.partial, c.partial_len);
+            c.partial_len = 0;
+            if (!on_reply(slot, c, resp)) continue;
+            if (in_burst(c)) {
+                burst_.answered++;
+                burst_.last_reply = now_ns();
+            }
+            if (!issue_request(slot, c)) return false;
+        }
+        return true;
+    }
+
+    // Сверяет ответ с ожидаемым значением. true — получены все ответы сообщения.
+    bool on_reply(uint32_t slot, Connection& c, std::string_view resp) {
+        uint64_t latency = now_ns() - c.started;
+        // С метками ядра задержка — от отправки последнего байта сообщения
+        // до приёма ответа, без планирования потоков клиента
+        bool kernel = false;
+        if (opt_.kernel_timestamps && rx_stamp_ns_ != 0) {
+            // Метка отправки попадает в очередь ошибок раньше, чем мог прийти ответ
+            if (stamps_[slot].tx_ns == 0) read_tx_stamps(slot, c);
+            uint64_t tx = stamps_[slot].tx_ns;
+            if (tx != 0 && rx_stamp_ns_ >= tx) {
+                latency = rx_stamp_ns_ - tx;
+                kernel = true;
+            }
+        }
+        const PendingExpr& e = c.msg.exprs[c.replied];
+        std::string_view expr = c.msg.expr(c.replied);
+        c.replied++;
+        set_pending(c, c.msg.count - c.replied);
+
+        // ERR совпадает только с ожидаемым делением на ноль, прочий
+        // нечисловой ответ учитывается как неразобранный
+        long server_res = 0;
+        auto parsed = std::from_chars(resp.data(), resp.data() + resp.size(), server_res);
+        bool numeric = parsed.ec == std::errc() && parsed.ptr == resp.data() + resp.size();
+        bool is_err = resp == "ERR";
+        if (is_err) server_res = ERR_REPLY;
+        else if (!numeric) server_res = long(mix64(std::hash<std::string_view>()(resp)));
+
+        long expected = expected_value(e);
+        bool counted = count_reply(endpoint(c), c.started, latency, server_res, expected,
+                                   numeric || is_err);
+        if (counted && kernel) endpoint(c).stats.kernel_timed.add();
+        if (in_burst(c)) burst_.latency.record(latency);
+        bool match = server_res == expected && (numeric || e.error);
+        if (opt_.quiet) {
+            if (!match && counted) log_mismatch_sample(c, expr, e, resp, latency);
+        } else if (!match) {
+            std::cerr << "Mismatch! Expr: " << expr << ", Server: " << resp
+                      << ", Expected: " << expected_text(e) << std::endl;
+        } else {
+            std::cout << "Match! Expr: " << expr << ", Result: " << resp << std::endl;
+        }
+        return c.replied == c.msg.count;
+    }
+
+    // Тихий режим: подробно печатаются только первые mismatch_samples расхождений
+    // на все потоки; строка собирается целиком, чтобы потоки не перемешивали вывод
+    void log_mismatch_sample(const Connection& c, std::string_view expr, const PendingExpr& e,
+                             std::string_view resp, uint64_t latency) {
+        int k = shared_.mismatches_logged.fetch_add(1, std::memory_order_relaxed);
+        if (k >= opt_.mismatch_samples) return;
+        std::ostringstream line;
+        line << "[Conn " << c.id << "] Mismatch #" << k + 1 << ": Expr: " << expr
+             << ", Server: " << resp << ", Expected: " << expected_text(e)
+             << ", Latency: " << latency / 1e3 << "us\n";
+        std::cerr << line.str() << std::flush;
+    }
+
+    const Options& opt_;
+    const int index_;             // номер потока
+    std::mt19937 rng_;            // фрагментация
+    FastRng gen_rng_;             // генерация выражений
+    const MessageArena* arena_;   // общая арена (nullptr — генерация на каждый запрос)
+    bool replay_;                 // арена — воспроизводимый корпус
+    CorpusWriter* recorder_;      // запись отправленных выражений (может быть nullptr)
+    SharedState& shared_;
+    uint64_t corpus_base_ts_ = 0; // время первой записи корпуса
+    std::vector<Endpoint> ep_;    // серверы: один, A и B или список --endpoints
+    int endpoints_ = 1;
+    bool ab_ = false;             // режим A/B
+    bool balancing_ = false;      // учёт незавершённых запросов для --balance least и p2c
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    uint64_t armed_at_ = 0;       // на какой момент взведён timerfd
+    std::unique_ptr<Uring> ring_; // движок io_uring (nullptr — epoll)
+    std::vector<char> recv_buffers_;  // общая группа буферов приёма io_uring
+    std::vector<std::pair<uint32_t, uint16_t>> starved_; // recv без буфера или места в SQ: (слот, поколение)
+    std::vector<std::pair<uint32_t, uint16_t>> unsent_;  // send без места в SQ
+    std::vector<uint16_t> unreturned_;                   // буферы приёма, не возвращённые ядру
+    uint32_t recv_in_progress_ = UINT32_MAX; // слот, чьё завершение recv сейчас разбирается
+    __kernel_timespec connect_timeout_{}; // связанный таймаут connect (--timeout)
+
+    bool churn_ = false;   // режим connect→request→close
+    long target_ = 0;      // сколько соединений открыть за прогон
+    double rate_ = 0;      // темп открытия, шт/с (0 — без ограничения)
+    long max_open_ = 0;    // churn: предел одновременно открытых соединений
+    long opened_ = 0;      // сколько уже открыто
+    long open_ = 0;        // сколько открыто сейчас
+    long idle_ = 0;        // из них удерживаются без запросов
+    uint64_t start_ = 0;
+    uint64_t measure_from_ = 0;  // начало окна измерения (после прогрева)
+    uint64_t measure_until_ = 0; // конец окна измерения
+    uint64_t stop_at_ = 0;       // конец прогона (после остывания)
+    uint64_t elapsed_ = 0;       // длительность окна измерения
+
+    // Пул соединений; номер слота передаётся в epoll_event.data
+    std::vector<Connection> slab_;
+    std::vector<uint32_t> free_slots_;
+    // Отложенные действия соединений: (момент, слот), ближайшее — наверху
+    std::priority_queue<std::pair<uint64_t, uint32_t>,
+                        std::vector<std::pair<uint64_t, uint32_t>>, std::greater<>> timers_;
+    // Проверки --timeout: (срок, слот); у слота не больше одной записи
+    std::priority_queue<std::pair<uint64_t, uint32_t>,
+                        std::vector<std::pair<uint64_t, uint32_t>>, std::greater<>> deadlines_;
+    std::vector<uint8_t> deadline_armed_; // у слота есть запись в deadlines_
+    std::vector<KernelStamps> stamps_;    // --timestamps kernel, параллельно slab_
+
+    bool burst_waiting_ = false;          // --burst: залп ещё впереди
+    bool in_burst_ = false;               // идёт отправка залпа
+    std::vector<uint32_t> burst_slots_;   // соединения, ждущие залпа
+    BurstStats burst_;
+    uint64_t rx_stamp_ns_ = 0; // метка приёма разбираемых данных (0 — нет)
+};
+
+// Счётчики «плохих» соединений одного режима
+struct AdversaryStats {
+    uint64_t opened = 0;          // успешных подключений, включая переподключения
+    uint64_t connect_errors = 0;
+    uint64_t server_closes = 0;   // соединение закрыто или сброшено сервером
+    uint64_t bytes_sent = 0;
+    uint64_t open_at_end = 0;     // сколько соединений оставалось открыто к концу прогона
+};
+
+// «Плохие» клиенты в отдельном потоке: держат заданное число соединений и раз в
+// интервал отправляют очередную порцию. Закрытое сервером соединение
+// переоткрывается на следующем шаге, так что давление сохраняется весь прогон.
+class Adversary {
+public:
+    explicit Adversary(const Options& opt) : opt_(opt), stats_(opt.adversaries.size()) {
+        serv_.sin_family = AF_INET;
+        inet_pton(AF_INET, opt.server_addr.c_str(), &serv_.sin_addr);
+        serv_.sin_port = htons(opt.server_port);
+        for (size_t k = 0; k < opt.adversaries.size(); ++k) {
+            for (int i = 0; i < opt.adversaries[k].count; ++i) {
+                AdvConn c;
+                c.kind = uint32_t(k);
+                conns_.push_back(c);
+            }
+        }
+    }
+
+    // Поток работает до вызова stop(); ready() — все соединения сделали первую попытку
+    void run() {
+        epoll_fd_ = epoll_create1(0);
+        if (epoll_fd_ < 0) { perror("epoll_create1"); ready_ = true; return; }
+        std::vector<epoll_event> events(MAX_EVENTS);
+        uint64_t next_tick = now_ns();
+        while (!stop_.load(std::memory_order_relaxed)) {
+            uint64_t now = now_ns();
+            if (now >= next_tick) {
+                tick();
+                ready_ = true;
+                next_tick = now + opt_.adversary_interval_ns;
+            }
+            int timeout = int((next_tick - std::min(next_tick, now_ns())) / 1000000) + 1;
+            int n = epoll_wait(epoll_fd_, events.data(), MAX_EVENTS, std::min(timeout, 50));
+            if (n < 0 && errno != EINTR) { perror("epoll_wait"); break; }
+            for (int i = 0; i < n; ++i) {
+                handle_event(uint32_t(events[i].data.u64), events[i].events);
+            }
+        }
+        for (AdvConn& c : conns_) {
+            if (c.fd < 0) continue;
+            if (c.connected) stats_[c.kind].open_at_end++;
+            close(c.fd);
+        }
+        close(epoll_fd_);
+    }
+
+    bool ready() const { return ready_.load(); }
+    void stop() { stop_ = true; }
+    const std::vector<AdversaryStats>& stats() const { return stats_; }
+
+private:
+    struct AdvConn {
+        int fd = -1;
+        uint32_t kind = 0;       // номер в opt.adversaries
+        bool connected = false;
+        uint64_t pos = 0;        // сколько байт потока отправлено
+    };
+
+    // Поток байт соединения — бесконечное повторение периода:
+    // конец периода совпадает с концом выражения (кроме endless)
+    static const std::string& period(AdvMode m) {
+        static const std::string slow = "1+2*3 ", noread = "1+2*3 ", endless = "1+", err = "1/0 ";
+        switch (m) {
+            case AdvMode::Slowloris: return slow;
+            case AdvMode::NoRead:    return noread;
+            case AdvMode::Endless:   return endless;
+            case AdvMode::ErrFlood:  return err;
+        }
+        return slow;
+    }
+
+    // Порция данных: период, повторённый до ~4 КБ
+    static const std::string& chunk(AdvMode m) {
+        static std::string chunks[4];
+        std::string& c = chunks[int(m)];
+        if (c.empty()) {
+            while (c.size() < 4096) c += period(m);
+        }
+        return c;
+    }
+
+    AdvMode mode(const AdvConn& c) const { return opt_.adversaries[c.kind].mode; }
+
+    void tick() {
+        for (uint32_t i = 0; i < conns_.size(); ++i) {
+            AdvConn& c = conns_[i];
+            if (c.fd < 0) open_connection(i);
+            else if (c.connected) send_portion(i);
+        }
+    }
+
+    void open_connection(uint32_t i) {
+        AdvConn& c = conns_[i];
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) { stats_[c.kind].connect_errors++; return; }
+        set_nonblocking(fd);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, (sockaddr*)&serv_, sizeof(serv_)) < 0 && errno != EINPROGRESS) {
+            stats_[c.kind].connect_errors++;
+            close(fd);
+            return;
+        }
+        c.fd = fd;
+        c.connected = false;
+        c.pos = 0;
+        // noread не читает ответы, но закрытие соединения сервером замечает по EPOLLRDHUP
+        epoll_event ev{};
+        ev.data.u64 = i;
+        ev.events = EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        if (mode(c) != AdvMode::NoRead) ev.events |= EPOLLIN;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void drop(AdvConn& c, bool by_server) {
+        if (by_server) stats_[c.kind].server_closes++;
+        close(c.fd);
+        c.fd = -1;
+        c.connected = false;
+    }
+
+    void handle_event(uint32_t i, uint32_t evs) {
+        AdvConn& c = conns_[i];
+        if (c.fd < 0) return;
+        if (!c.connected) {
+            if (!(evs & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+            if (err != 0) {
+                stats_[c.kind].connect_errors++;
+                drop(c, false);
+                return;
+            }
+            c.connected = true;
+            stats_[c.kind].opened++;
+            send_portion(i);
+            if (c.fd < 0) return;
+        }
+        if (mode(c) == AdvMode::NoRead) {
+            if (evs & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) drop(c, true);
+            return;
+        }
+        if (evs & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            // Ответы не нужны — только освобождаем приёмный буфер
+            char buf[4096];
+            while (true) {
+                ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+                if (n > 0) continue;
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) drop(c, true);
+                break;
+            }
+        }
+    }
+
+    // slowloris отправляет один байт, остальные режимы — порцию в ~4 КБ.
+    // Если буфер отправки полон, порция пропускается.
+    void send_portion(uint32_t i) {
+        AdvConn& c = conns_[i];
+        AdvMode m = mode(c);
+        const std::string& data = chunk(m);
+        size_t off = c.pos % period(m).size();
+        size_t len = m == AdvMode::Slowloris ? 1 : data.size() - off;
+        ssize_t sent = send(c.fd, data.data() + off, len, MSG_NOSIGNAL);
+        if (sent > 0) {
+            c.pos += uint64_t(sent);
+            stats_[c.kind].bytes_sent += uint64_t(sent);
+        } else if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            drop(c, true);
+        }
+    }
+
+    const Options& opt_;
+    sockaddr_in serv_{};
+    int epoll_fd_ = -1;
+    std::vector<AdvConn> conns_;
+    std::vector<AdversaryStats> stats_;   // по одному на элемент opt.adversaries
+    std::atomic<bool> ready_{false};
+    std::atomic<bool> stop_{false};
+};
+
+// Печатает перцентили гистограммы в микросекундах
+void print_latency(const char* title, const Histogram& h) {
+    std::printf("%-16s n=%-8llu min=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f (us)\n",
+                title, (unsigned long long)h.count(),
+                h.min() / 1e3, h.percentile(50) / 1e3, h.percentile(90) / 1e3,
+                h.percentile(99) / 1e3, h.percentile(99.9) / 1e3, h.max() / 1e3);
+}
+
+// peaks_summed — итоги нескольких процессов, open_peak в них сумма их пиков
+void print_summary(const Stats& s, uint64_t elapsed_ns, bool peaks_summed = false) {
+    double secs = elapsed_ns / 1e9;
+    std::fflush(stdout);
+    std::printf("--- Summary (%.3f s) ---\n", secs);
+    std::printf("Connections: ok=%llu errors=%llu (%.1f/s)\n",
+                (unsigned long long)s.connects_ok.get(), (unsigned long long)s.connect_errors.get(),
+                secs > 0 ? s.connects_ok.get() / secs : 0.0);
+    std::printf("Requests:    match=%llu mismatch=%llu timeouts=%llu resets=%llu "
+                "parse_failures=%llu io_errors=%llu (%.1f/s)\n",
+                (unsigned long long)s.matches.get(), (unsigned long long)s.mismatches.get(),
+                (unsigned long long)s.timeouts.get(), (unsigned long long)s.resets.get(),
+                (unsigned long long)s.parse_failures.get(), (unsigned long long)s.io_errors.get(),
+                secs > 0 ? s.replies() / secs : 0.0);
+    std::printf("Open peak:   %llu connections%s\n", (unsigned long long)s.open_peak,
+                peaks_summed ? " (sum of per-worker peaks)" : "");
+    print_latency("Connect latency", s.connect_latency);
+    print_latency("Request latency", s.request_latency);
+    if (s.kernel_timed.get() > 0) {
+        std::printf("Timestamps:  kernel for %llu of %llu replies\n",
+                    (unsigned long long)s.kernel_timed.get(), (unsigned long long)s.replies());
+    }
+    // Одинаковые дайджесты означают совпадение всех ответов с ожидаемыми
+    // независимо от порядка, в котором они пришли. Без ответов сравнивать нечего:
+    // нулевые дайджесты совпали бы и у прогона против молчащего сервера
+    if (s.replies() == 0) {
+        std::printf("Digest:      no replies\n");
+        return;
+    }
+    std::printf("Digest:      server=%016llx expected=%016llx %s\n",
+                (unsigned long long)s.digest.get(), (unsigned long long)s.expected_digest.get(),
+                s.digest.get() == s.expected_digest.get() ? "OK" : "DIFFERENT");
+}
+
+// Ни один запрос не получил ответа: все оборвались по таймауту, сбросу
+// или ошибке подключения. Такой прогон завершается с кодом 1
+bool no_replies(const Stats& s) {
+    uint64_t failed = s.timeouts.get() + s.resets.get() + s.connect_errors.get() + s.io_errors.get();
+    return s.replies() == 0 && failed > 0;
+}
+
+// Поднимает мягкий предел числа открытых файлов до need (но не выше жёсткого)
+void raise_fd_limit(rlim_t need) {
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur >= need) return;
+    rl.rlim_cur = rl.rlim_max == RLIM_INFINITY ? need : std::min(need, rl.rlim_max);
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0) perror("setrlimit(RLIMIT_NOFILE)");
+    if (rl.rlim_cur < need) {
+        std::cerr << "Warning: RLIMIT_NOFILE hard limit " << rl.rlim_max << " is below "
+                  << need << " descriptors; raise it with ulimit -Hn\n";
+    }
+}
+
+// Итоги по серверам --endpoints: медленный сервер виден по задержкам
+// и по доле ответов, которая при least и p2c уходит от него к остальным
+void print_endpoints(const Options& opt, const std::vector<Stats>& eps, uint64_t elapsed_ns) {
+    std::vector<ServerAddr> servers = server_list(opt);
+    double secs = elapsed_ns / 1e9;
+    uint64_t replies = 0;
+    for (const Stats& s : eps) replies += s.replies();
+    std::printf("--- Endpoints (balance %s) ---\n", balance_name(opt.balance));
+    for (size_t e = 0; e < eps.size(); ++e) {
+        const Stats& s = eps[e];
+        const Histogram& h = s.request_latency;
+        std::string name = servers[e].addr + ":" + std::to_string(servers[e].port);
+        std::printf("%-21s conns=%llu replies=%llu (%.1f%%, %.1f/s) mismatch=%llu errors=%llu "
+                    "p50=%.1f p99=%.1f p99.9=%.1f max=%.1f (us)\n",
+                    name.c_str(), (unsigned long long)s.connects_ok.get(),
+                    (unsigned long long)s.replies(), replies ? 100.0 * s.replies() / replies : 0.0,
+                    secs > 0 ? s.replies() / secs : 0.0, (unsigned long long)s.mismatches.get(),
+                    (unsigned long long)(s.connect_errors.get() + s.io_errors.get() +
+                                         s.timeouts.get() + s.resets.get() +
+                                         s.parse_failures.get()),
+                    h.percentile(50) / 1e3, h.percentile(99) / 1e3, h.percentile(99.9) / 1e3,
+                    h.max() / 1e3);
+    }
+}
+
+// Итоги «плохих» соединений по режимам
+void print_adversaries(const Options& opt, const std::vector<AdversaryStats>& adv) {
+    for (size_t k = 0; k < adv.size(); ++k) {
+        const AdversaryStats& a = adv[k];
+        std::printf("Adversary %-9s conns=%d opened=%llu connect_errors=%llu server_closes=%llu "
+                    "open_at_end=%llu sent=%.1fKB\n",
+                    adv_mode_name(opt.adversaries[k].mode), opt.adversaries[k].count,
+                    (unsigned long long)a.opened, (unsigned long long)a.connect_errors,
+                    (unsigned long long)a.server_closes, (unsigned long long)a.open_at_end,
+                    a.bytes_sent / 1024.0);
+    }
+}
+
+// Итоги залпа: разброс отправки по потокам, время разгребания и задержки
+void print_burst(const BurstStats& b) {
+    std::printf("--- Burst ---\n");
+    std::printf("Released:    %llu messages, answered %llu\n",
+                (unsigned long long)b.released, (unsigned long long)b.answered);
+    if (b.released == 0) return;
+    std::printf("Send spread: %.1f us (release to last send %.1f us)\n",
+                (b.last_send - b.first_send) / 1e3, (b.last_send - b.release_at) / 1e3);
+    if (b.last_reply > 0) {
+        std::printf("Drain:       %.1f us from release to the last reply\n",
+                    (b.last_reply - b.release_at) / 1e3);
+    }
+    print_latency("Burst latency", b.latency);
+}
+
+// Оценка средней разности с 95% доверительным интервалом
+struct Estimate {
+    double mean = 0;
+    double half = NAN;   // полуширина интервала (NaN — меньше двух наблюдений)
+    size_t n = 0;
+};
+
+// Квантиль 0.975 распределения Стьюдента с df степенями свободы
+double t975(size_t df) {
+    static const double table[] = {0,      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+                                   2.306,  2.262,  2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+                                   2.120,  2.110,  2.101, 2.093, 2.086, 2.080, 2.074, 2.069,
+                                   2.064,  2.060,  2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df < sizeof(table) / sizeof(table[0])) return table[df];
+    return 1.960 + 2.4 / double(df);
+}
+
+Estimate estimate_mean(const std::vector<double>& d) {
+    Estimate e;
+    e.n = d.size();
+    if (d.empty()) return e;
+    for (double x : d) e.mean += x;
+    e.mean /= double(d.size());
+    if (d.size() < 2) return e;
+    double ss = 0;
+    for (double x : d) ss += (x - e.mean) * (x - e.mean);
+    e.half = t975(d.size() - 1) * std::sqrt(ss / double(d.size() - 1) / double(d.size()));
+    return e;
+}
+
+// Итог сравнения B с A. Разности оцениваются по парам одноимённых секунд
+// прогона: A и B нагружаются одновременно, поэтому общий фон машины влияет
+// на обе стороны пары одинаково.
+struct AbComparison {
+    double rps[2] = {0, 0};
+    double p50[2] = {0, 0};
+    double p99[2] = {0, 0};
+    Estimate d_rps;       // B − A, запросов в секунду
+    Estimate d_p50;       // B − A, нс
+    Estimate d_p99;       // B − A, нс
+    bool comparable = false; // обе стороны ответили на один и тот же набор выражений
+    bool identical = false;  // и ответы совпали
+};
+
+AbComparison compare_ab(const Stats* s, const std::vector<IntervalStats>* series,
+                        uint64_t elapsed_ns) {
+    AbComparison ab;
+    double secs = elapsed_ns / 1e9;
+    for (int e = 0; e < 2; ++e) {
+        ab.rps[e] = secs > 0 ? s[e].replies() / secs : 0.0;
+        ab.p50[e] = s[e].request_latency.percentile(50);
+        ab.p99[e] = s[e].request_latency.percentile(99);
+    }
+    // Только полные секунды, присутствующие в обоих рядах
+    uint64_t full = elapsed_ns / 1000000000ull;
+    std::map<uint64_t, const IntervalStats*> a;
+    for (const IntervalStats& t : series[0]) a[t.second] = &t;
+    std::vector<double> d_rps, d_p50, d_p99;
+    for (const IntervalStats& tb : series[1]) {
+        auto it = a.find(tb.second);
+        if (tb.second >= full || it == a.end()) continue;
+        const IntervalStats& ta = *it->second;
+        d_rps.push_back(double(tb.requests) - double(ta.requests));
+        if (ta.requests > 0 && tb.requests > 0) {
+            d_p50.push_back(double(tb.p50) - double(ta.p50));
+            d_p99.push_back(double(tb.p99) - double(ta.p99));
+        }
+    }
+    ab.d_rps = estimate_mean(d_rps);
+    ab.d_p50 = estimate_mean(d_p50);
+    ab.d_p99 = estimate_mean(d_p99);
+
+    // Дайджест ожидаемых значений совпадает, если обе стороны получили одни и те же выражения
+    ab.comparable = s[0].replies() == s[1].replies() &&
+                    s[0].expected_digest.get() == s[1].expected_digest.get();
+    ab.identical = ab.comparable && s[0].digest.get() == s[1].digest.get();
+    return ab;
+}
+
+// Разность с интервалом: "+12.3 ±4.5" (scale переводит единицы)
+std::string format_diff(const Estimate& e, double scale) {
+    char buf[96];
+    if (e.n == 0) return "n/a";
+    if (std::isnan(e.half)) {
+        std::snprintf(buf, sizeof(buf), "%+.1f (CI n/a, n=%zu)", e.mean * scale, e.n);
+    } else {
+        std::snprintf(buf, sizeof(buf), "%+.1f ±%.1f (95%% CI, n=%zu)", e.mean * scale,
+                      e.half * scale, e.n);
+    }
+    return buf;
+}
+
+void print_ab(const Options& opt, const AbComparison& ab, const Stats* s) {
+    std::printf("--- A/B: B=%s:%d vs A=%s:%d ---\n", opt.ab_addr.c_str(), opt.ab_port,
+                opt.server_addr.c_str(), opt.server_port);
+    std::printf("Throughput:  A=%.1f/s B=%.1f/s (%+.2f%%), per-second diff %s req/s\n",
+                ab.rps[0], ab.rps[1], ab.rps[0] > 0 ? (ab.rps[1] / ab.rps[0] - 1) * 100 : 0.0,
+                format_diff(ab.d_rps, 1).c_str());
+    std::printf("p50 latency: A=%.1fus B=%.1fus, per-second diff %s us\n",
+                ab.p50[0] / 1e3, ab.p50[1] / 1e3, format_diff(ab.d_p50, 1e-3).c_str());
+    std::printf("p99 latency: A=%.1fus B=%.1fus, per-second diff %s us\n",
+                ab.p99[0] / 1e3, ab.p99[1] / 1e3, format_diff(ab.d_p99, 1e-3).c_str());
+    if (ab.comparable) {
+        std::printf("Results:     %s\n", ab.identical ? "identical" : "DIFFERENT");
+    } else {
+        // По времени стороны успевают ответить на разное число выражений;
+        // тогда каждая сверяется только со своими ожидаемыми значениями
+        std::printf("Results:     different expression sets (A=%llu, B=%llu replies); "
+                    "A %s, B %s\n",
+                    (unsigned long long)s[0].replies(),
+                    (unsigned long long)s[1].replies(),
+                    s[0].digest.get() == s[0].expected_digest.get() ? "correct" : "WRONG",
+                    s[1].digest.get() == s[1].expected_digest.get() ? "correct" : "WRONG");
+    }
+}
+
+// Генерирует корпус из corpus_size выражений по seed и записывает его в файл
+int make_corpus(const Options& opt) {
+    FastRng rng(opt.seed);
+    std::string buf(max_expression_length(opt.n, opt.workload), '\0');
+    CorpusWriter writer;
+    for (long i = 0; i < opt.corpus_size; ++i) {
+        long expected;
+        bool error;
+        size_t len = make_expression(opt.workload, opt.n, rng, &buf[0], expected, error);
+        writer.add(std::string_view(buf.data(), len), expected, error, 0);
+    }
+    if (!writer.write(opt.make_corpus, opt.seed, false)) return 1;
+    std::cout << "Corpus " << opt.make_corpus << ": " << writer.size()
+              << " expressions, seed " << opt.seed << std::endl;
+    return 0;
+}
+
+// Процессорное время, потраченное самим клиентом
+struct CpuUsage {
+    double user_s = 0;
+    double sys_s = 0;
+    long max_rss_kb = 0;
+};
+
+CpuUsage cpu_usage() {
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    CpuUsage u;
+    u.user_s = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    u.sys_s = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    u.max_rss_kb = ru.ru_maxrss;
+    return u;
+}
+
+std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out.push_back('\\');
+            out.push_back(ch);
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", ch);
+            out += buf;
+        } else {
+            out.push_back(ch);
+        }
+    }
+    return out;
+}
+
+void write_json_latency(FILE* f, const char* name, const Histogram& h) {
+    std::fprintf(f, "  \"%s\": {\"count\": %llu, \"min\": %.3f, \"mean\": %.3f, "
+                    "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p99_9\": %.3f, \"max\": %.3f},\n",
+                 name, (unsigned long long)h.count(), h.min() / 1e3, h.mean() / 1e3,
+                 h.percentile(50) / 1e3, h.percentile(90) / 1e3, h.percentile(99) / 1e3,
+                 h.percentile(99.9) / 1e3, h.max() / 1e3);
+}
+
+bool write_json_report(const std::string& path, const Options& opt, const Stats& s,
+                       const std::vector<IntervalStats>& series, uint64_t elapsed_ns,
+                       const CpuUsage& cpu, const std::vector<AdversaryStats>& adv,
+                       const AbComparison* ab, const BurstStats* burst,
+                       const std::vector<Stats>* endpoints) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) { perror(path.c_str()); return false; }
+    double secs = elapsed_ns / 1e9;
+    uint64_t replies = s.replies();
+
+    std::fprintf(f, "{\n");
+    std::fprintf(f, "  \"config\": {\"n\": %d, \"connections\": %d, \"requests\": %d, "
+                    "\"server\": \"%s:%d\", \"seed\": %llu, \"ramp_rate\": %g, "
+                    "\"churn_rate\": %g, \"corpus\": \"%s\", \"duration_s\": %g, "
+                    "\"warmup_s\": %g, \"cooldown_s\": %g, \"threads\": %d, \"workload\": \"%s\", "
+                    "\"timestamps\": \"%s\", \"workers\": %d},\n",
+                 opt.n, opt.connections, opt.requests, json_escape(opt.server_addr).c_str(),
+                 opt.server_port, (unsigned long long)opt.seed, opt.ramp_rate, opt.churn_rate,
+                 json_escape(opt.corpus).c_str(), opt.duration, opt.warmup, opt.cooldown,
+                 opt.threads, json_escape(opt.workload.spec).c_str(),
+                 opt.kernel_timestamps ? "kernel" : "user", std::max(opt.workers, 1));
+    std::fprintf(f, "  \"duration_s\": %.6f,\n", secs);
+    std::fprintf(f, "  \"throughput_rps\": %.3f,\n", secs > 0 ? replies / secs : 0.0);
+    std::fprintf(f, "  \"connections\": {\"ok\": %llu, \"errors\": %llu, \"rate_per_s\": %.3f},\n",
+                 (unsigned long long)s.connects_ok.get(), (unsigned long long)s.connect_errors.get(),
+                 secs > 0 ? s.connects_ok.get() / secs : 0.0);
+    std::fprintf(f, "  \"requests\": {\"replies\": %llu, \"match\": %llu, \"mismatch\": %llu, "
+                    "\"timeouts\": %llu, \"resets\": %llu, \"parse_failures\": %llu, "
+                    "\"io_errors\": %llu, \"kernel_timed\": %llu},\n",
+                 (unsigned long long)replies, (unsigned long long)s.matches.get(),
+                 (unsigned long long)s.mismatches.get(), (unsigned long long)s.timeouts.get(),
+                 (unsigned long long)s.resets.get(), (unsigned long long)s.parse_failures.get(),
+                 (unsigned long long)s.io_errors.get(), (unsigned long long)s.kernel_timed.get());
+    write_json_latency(f, "connect_latency_us", s.connect_latency);
+    write_json_latency(f, "request_latency_us", s.request_latency);
+    std::fprintf(f, "  \"cpu\": {\"user_s\": %.6f, \"sys_s\": %.6f, \"utilization\": %.4f, "
+                    "\"max_rss_kb\": %ld},\n",
+                 cpu.user_s, cpu.sys_s, secs > 0 ? (cpu.user_s + cpu.sys_s) / secs : 0.0,
+                 cpu.max_rss_kb);
+    std::fprintf(f, "  \"digest\": {\"server\": \"%016llx\", \"expected\": \"%016llx\"},\n",
+                 (unsigned long long)s.digest.get(), (unsigned long long)s.expected_digest.get());
+    if (ab) {
+        auto est = [&](const char* name, const Estimate& e, double scale) {
+            std::fprintf(f, "\"%s\": {\"mean\": %.3f, \"ci95\": %.3f, \"n\": %zu}", name,
+                         e.mean * scale, std::isnan(e.half) ? 0.0 : e.half * scale, e.n);
+        };
+        std::fprintf(f, "  \"ab\": {\"b_server\": \"%s:%d\", \"throughput_rps\": [%.3f, %.3f], "
+                        "\"p50_us\": [%.3f, %.3f], \"p99_us\": [%.3f, %.3f], ",
+                     json_escape(opt.ab_addr).c_str(), opt.ab_port, ab->rps[0], ab->rps[1],
+                     ab->p50[0] / 1e3, ab->p50[1] / 1e3, ab->p99[0] / 1e3, ab->p99[1] / 1e3);
+        est("diff_rps", ab->d_rps, 1);
+        std::fprintf(f, ", ");
+        est("diff_p50_us", ab->d_p50, 1e-3);
+        std::fprintf(f, ", ");
+        est("diff_p99_us", ab->d_p99, 1e-3);
+        std::fprintf(f, ", \"comparable\": %s, \"identical\": %s},\n",
+                     ab->comparable ? "true" : "false", ab->identical ? "true" : "false");
+    }
+    if (burst) {
+        std::fprintf(f, "  \"burst\": {\"released\": %llu, \"answered\": %llu, "
+                        "\"send_spread_us\": %.3f, \"drain_us\": %.3f},\n",
+                     (unsigned long long)burst->released, (unsigned long long)burst->answered,
+                     burst->released ? (burst->last_send - burst->first_send) / 1e3 : 0.0,
+                     burst->last_reply ? (burst->last_reply - burst->release_at) / 1e3 : 0.0);
+        write_json_latency(f, "burst_latency_us", burst->latency);
+    }
+    if (endpoints) {
+        std::vector<ServerAddr> servers = server_list(opt);
+        std::fprintf(f, "  \"balance\": \"%s\",\n  \"endpoints\": [", balance_name(opt.balance));
+        for (size_t e = 0; e < endpoints->size(); ++e) {
+            const Stats& es = (*endpoints)[e];
+            const Histogram& h = es.request_latency;
+            std::fprintf(f, "%s\n    {\"server\": \"%s:%d\", \"connections\": %llu, "
+                            "\"replies\": %llu, \"throughput_rps\": %.3f, \"mismatch\": %llu, "
+                            "\"connect_errors\": %llu, \"timeouts\": %llu, \"resets\": %llu, "
+                            "\"parse_failures\": %llu, \"io_errors\": %llu, "
+                            "\"request_latency_us\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+                            "\"p99_9\": %.3f, \"max\": %.3f}}",
+                         e ? "," : "", json_escape(servers[e].addr).c_str(), servers[e].port,
+                         (unsigned long long)es.connects_ok.get(), (unsigned long long)es.replies(),
+                         secs > 0 ? es.replies() / secs : 0.0, (unsigned long long)es.mismatches.get(),
+                         (unsigned long long)es.connect_errors.get(),
+                         (unsigned long long)es.timeouts.get(), (unsigned long long)es.resets.get(),
+                         (unsigned long long)es.parse_failures.get(),
+                         (unsigned long long)es.io_errors.get(), h.percentile(50) / 1e3,
+                         h.percentile(90) / 1e3, h.percentile(99) / 1e3, h.percentile(99.9) / 1e3,
+                         h.max() / 1e3);
+        }
+        std::fprintf(f, "\n  ],\n");
+    }
+    std::fprintf(f, "  \"adversaries\": [");
+    for (size_t k = 0; k < adv.size(); ++k) {
+        const AdversaryStats& a = adv[k];
+        std::fprintf(f, "%s\n    {\"mode\": \"%s\", \"connections\": %d, \"opened\": %llu, "
+                        "\"connect_errors\": %llu, \"server_closes\": %llu, "
+                        "\"open_at_end\": %llu, \"bytes_sent\": %llu}",
+                     k ? "," : "", adv_mode_name(opt.adversaries[k].mode), opt.adversaries[k].count,
+                     (unsigned long long)a.opened, (unsigned long long)a.connect_errors,
+                     (unsigned long long)a.server_closes, (unsigned long long)a.open_at_end,
+                     (unsigned long long)a.bytes_sent);
+    }
+    std::fprintf(f, "%s],\n", adv.empty() ? "" : "\n  ");
+    std::fprintf(f, "  \"timeseries\": [");
+    const auto& iv = series;
+    for (size_t i = 0; i < iv.size(); ++i) {
+        const IntervalStats& t = iv[i];
+        std::fprintf(f, "%s\n    {\"second\": %llu, \"connects\": %llu, \"connect_errors\": %llu, "
+                        "\"requests\": %llu, \"mismatches\": %llu, \"timeouts\": %llu, "
+                        "\"resets\": %llu, \"parse_failures\": %llu, \"io_errors\": %llu, "
+                        "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, "
+                        "\"p99_9_us\": %.3f, \"max_us\": %.3f}",
+                     i ? "," : "", (unsigned long long)t.second, (unsigned long long)t.connects,
+                     (unsigned long long)t.connect_errors, (unsigned long long)t.requests,
+                     (unsigned long long)t.mismatches, (unsigned long long)t.timeouts,
+                     (unsigned long long)t.resets, (unsigned long long)t.parse_failures,
+                     (unsigned long long)t.io_errors,
+                     t.p50 / 1e3, t.p90 / 1e3, t.p99 / 1e3, t.p999 / 1e3, t.max / 1e3);
+    }
+    std::fprintf(f, "\n  ]\n}\n");
+    bool ok = std::ferror(f) == 0;
+    std::fclose(f);
+    return ok;
+}
+
+// CSV: строка на каждую секунду и итоговая строка second=total
+bool write_csv_report(const std::string& path, const Stats& s,
+                      const std::vector<IntervalStats>& series, uint64_t elapsed_ns,
+                      const CpuUsage& cpu) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) { perror(path.c_str()); return false; }
+    std::fprintf(f, "second,connects,connect_errors,requests,mismatches,timeouts,resets,"
+                    "parse_failures,io_errors,p50_us,p90_us,p99_us,p99_9_us,max_us,rps,cpu_user_s,cpu_sys_s\n");
+    for (const IntervalStats& t : series) {
+        // Последний интервал может быть неполным, поэтому rps для него — оценка
+        std::fprintf(f, "%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%llu,,\n",
+                     (unsigned long long)t.second, (unsigned long long)t.connects,
+                     (unsigned long long)t.connect_errors, (unsigned long long)t.requests,
+                     (unsigned long long)t.mismatches, (unsigned long long)t.timeouts,
+                     (unsigned long long)t.resets, (unsigned long long)t.parse_failures,
+                     (unsigned long long)t.io_errors,
+                     t.p50 / 1e3, t.p90 / 1e3, t.p99 / 1e3, t.p999 / 1e3, t.max / 1e3,
+                     (unsigned long long)t.requests);
+    }
+    double secs = elapsed_ns / 1e9;
+    const Histogram& h = s.request_latency;
+    std::fprintf(f, "total,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+                    "%.6f,%.6f\n",
+                 (unsigned long long)s.connects_ok.get(), (unsigned long long)s.connect_errors.get(),
+                 (unsigned long long)s.replies(), (unsigned long long)s.mismatches.get(),
+                 (unsigned long long)s.timeouts.get(), (unsigned long long)s.resets.get(),
+                 (unsigned long long)s.parse_failures.get(), (unsigned long long)s.io_errors.get(), h.percentile(50) / 1e3, h.percentile(90) / 1e3,
+                 h.percentile(99) / 1e3, h.percentile(99.9) / 1e3, h.max() / 1e3,
+                 secs > 0 ? s.replies() / secs : 0.0, cpu.user_s, cpu.sys_s);
+    bool ok = std::ferror(f) == 0;
+    std::fclose(f);
+    return ok;
+}
+
+// Итоги одного прогона клиента по серверам
+struct RunResult {
+    Stats totals[MAX_ENDPOINTS];
+    std::vector<IntervalStats> series[MAX_ENDPOINTS];
+    std::vector<Stats> endpoints;  // по серверам --endpoints; их сумма — totals[0]
+    BurstStats burst;
+    uint64_t elapsed = 0;
+    int rc = 0;
+};
+
+// Запускает потоки клиента и ждёт их завершения. При progress в тихом
+// режиме раз в секунду печатается прогресс по счётчикам потоков.
+void run_clients(const Options& opt, const MessageArena* arena,
+                 std::vector<CorpusWriter>* recorders, bool progress, RunResult& out) {
+    // Итогов и рядов два (A и B) или один, общий для всех серверов
+    int servers = int(server_list(opt).size());
+    int sides = opt.ab_addr.empty() ? 1 : 2;
+    SharedState shared(opt.threads * (servers / sides));
+    std::vector<std::unique_ptr<Client>> clients;
+    for (int t = 0; t < opt.threads; ++t) {
+        clients.emplace_back(new Client(opt, t, arena, !opt.corpus.empty(),
+                                        recorders ? &(*recorders)[t] : nullptr, shared));
+    }
+
+    shared.start = now_ns();
+    std::atomic<int> running{opt.threads};
+    std::vector<int> codes(opt.threads, 0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < opt.threads; ++t) {
+        threads.emplace_back([&, t] {
+            codes[t] = clients[t]->run();
+            running.fetch_sub(1);
+        });
+    }
+
+    uint64_t next_progress = shared.start + 1000000000ull;
+    uint64_t last_replies = 0;
+    while (running.load() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t now = now_ns();
+        if (!opt.quiet || !progress || now < next_progress) continue;
+        uint64_t replies = 0, mismatches = 0, errors = 0;
+        for (const auto& c : clients) {
+            for (int e = 0; e < servers; ++e) {
+                const Stats& st = c->stats(e);
+                replies += st.replies();
+                mismatches += st.mismatches.get();
+                errors += st.io_errors.get() + st.connect_errors.get() + st.timeouts.get() +
+                          st.resets.get() + st.parse_failures.get();
+            }
+        }
+        std::printf("[%3llus] replies=%llu (+%llu/s) mismatches=%llu errors=%llu\n",
+                    (unsigned long long)((now - shared.start) / 1000000000ull),
+                    (unsigned long long)replies, (unsigned long long)(replies - last_replies),
+                    (unsigned long long)mismatches, (unsigned long long)errors);
+        std::fflush(stdout);
+        last_replies = replies;
+        next_progress += 1000000000ull;
+    }
+    for (auto& th : threads) th.join();
+
+    if (!opt.replicas.empty()) out.endpoints = std::vector<Stats>(servers);
+    for (int t = 0; t < opt.threads; ++t) {
+        for (int e = 0; e < servers; ++e) {
+            out.totals[sides == 2 ? e : 0].merge(clients[t]->stats(e));
+            if (!out.endpoints.empty()) out.endpoints[e].merge(clients[t]->stats(e));
+        }
+        out.burst.merge(clients[t]->burst());
+        out.elapsed = std::max(out.elapsed, clients[t]->elapsed_ns());
+        if (codes[t] != 0) out.rc = codes[t];
+    }
+    // Пики берутся из общих счётчиков, а не складываются по потокам
+    for (int e = 0; e < servers; ++e) {
+        uint64_t peak = uint64_t(shared.open_to[e].peak.load());
+        if (sides == 2) out.totals[e].open_peak = peak;
+        if (!out.endpoints.empty()) out.endpoints[e].open_peak = peak;
+    }
+    if (sides != 2) out.totals[0].open_peak = uint64_t(shared.open.peak.load());
+    for (int e = 0; e < sides; ++e) out.series[e] = shared.series[e].intervals();
+}
+
+// Одна ступень поиска: нагрузка с заданным числом соединений
+struct SearchStep {
+    int connections = 0;
+    double rps = 0;
+    uint64_t p50 = 0, p99 = 0;   // нс
+    uint64_t errors = 0;         // ошибки подключения и запросы без ответа
+    bool ok = false;             // p99 в пределах SLO и без ошибок
+};
+
+SearchStep run_search_step(const Options& opt, const MessageArena* arena, int connections) {
+    Options step = opt;
+    step.connections = connections;
+    step.quiet = true;
+    RunResult run;
+    run_clients(step, arena, nullptr, false, run);
+    const Stats& s = run.totals[0];
+    SearchStep r;
+    r.connections = connections;
+    r.rps = run.elapsed > 0 ? s.replies() / (run.elapsed / 1e9) : 0.0;
+    r.p50 = s.request_latency.percentile(50);
+    r.p99 = s.request_latency.percentile(99);
+    r.errors = s.connect_errors.get() + s.timeouts.get() + s.resets.get() + s.io_errors.get();
+    // Ступень без ошибок: иначе сервер получил не ту нагрузку, которую задали
+    r.ok = s.replies() > 0 && r.errors == 0 && r.p99 <= opt.slo_p99_ns;
+    std::printf("[search] conns=%-7d rps=%-11.1f p50=%.1fus p99=%.1fus errors=%llu %s\n",
+                connections, r.rps, r.p50 / 1e3, r.p99 / 1e3, (unsigned long long)r.errors,
+                r.ok ? "ok" : "over SLO");
+    std::fflush(stdout);
+    return r;
+}
+
+// Поиск наибольшей пропускной способности при p99 не выше SLO. Нагрузка
+// задаётся числом соединений (замкнутый цикл: каждое ждёт ответа перед
+// следующим запросом). Сначала число соединений удваивается до нарушения
+// SLO или <connections>, затем граница уточняется делением пополам с
+// точностью до 5%. Каждая ступень — отдельный прогон --warmup + --duration.
+bool run_search(const Options& opt, const MessageArena* arena, std::vector<SearchStep>& steps) {
+    int good = 0, bad = 0;
+    for (int c = std::min(opt.search_start, opt.connections); ; c = std::min(c * 2, opt.connections)) {
+        steps.push_back(run_search_step(opt, arena, c));
+        if (!steps.back().ok) { bad = c; break; }
+        good = c;
+        if (c == opt.connections) break;
+    }
+    while (good > 0 && bad > 0 && bad - good > std::max(1, good / 20)) {
+        int mid = good + (bad - good) / 2;
+        steps.push_back(run_search_step(opt, arena, mid));
+        if (steps.back().ok) good = mid;
+        else bad = mid;
+    }
+    std::sort(steps.begin(), steps.end(),
+              [](const SearchStep& a, const SearchStep& b) { return a.connections < b.connections; });
+    return good > 0;
+}
+
+// Кривая задержки и «колено»: ступень с наибольшей пропускной способностью в пределах SLO
+const SearchStep* search_knee(const std::vector<SearchStep>& steps) {
+    const SearchStep* knee = nullptr;
+    for (const SearchStep& st : steps) {
+        if (st.ok && (!knee || st.rps > knee->rps)) knee = &st;
+    }
+    return knee;
+}
+
+void print_search(const Options& opt, const std::vector<SearchStep>& steps) {
+    std::printf("--- Search (p99 SLO %.1f us) ---\n", opt.slo_p99_ns / 1e3);
+    std::printf("%10s %12s %12s %12s %8s\n", "conns", "rps", "p50_us", "p99_us", "errors");
+    for (const SearchStep& st : steps) {
+        std::printf("%10d %12.1f %12.1f %12.1f %8llu%s\n", st.connections, st.rps, st.p50 / 1e3,
+                    st.p99 / 1e3, (unsigned long long)st.errors, st.ok ? "" : "  over SLO");
+    }
+    const SearchStep* knee = search_knee(steps);
+    if (knee) {
+        std::printf("Knee:        %d connections, %.1f req/s at p99 %.1f us\n",
+                    knee->connections, knee->rps, knee->p99 / 1e3);
+    } else {
+        std::printf("Knee:        none, SLO is missed already at %d connections\n",
+                    steps.empty() ? 0 : steps.front().connections);
+    }
+}
+
+bool write_search_report(const std::string& path, const Options& opt,
+                         const std::vector<SearchStep>& steps) {
+    FILE* f = std::fopen(path.c_str(), "w");
+    if (!f) { perror(path.c_str()); return false; }
+    const SearchStep* knee = search_knee(steps);
+    std::fprintf(f, "{\n");
+    std::fprintf(f, "  \"config\": {\"n\": %d, \"max_connections\": %d, \"server\": \"%s:%d\", "
+                    "\"duration_s\": %g, \"warmup_s\": %g, \"threads\": %d, \"workload\": \"%s\"},\n",
+                 opt.n, opt.connections, json_escape(opt.server_addr).c_str(), opt.server_port,
+                 opt.duration, opt.warmup, opt.threads, json_escape(opt.workload.spec).c_str());
+    std::fprintf(f, "  \"slo_p99_us\": %.3f,\n", opt.slo_p99_ns / 1e3);
+    if (knee) {
+        std::fprintf(f, "  \"knee\": {\"connections\": %d, \"throughput_rps\": %.3f, "
+                        "\"p50_us\": %.3f, \"p99_us\": %.3f},\n",
+                     knee->connections, knee->rps, knee->p50 / 1e3, knee->p99 / 1e3);
+    } else {
+        std::fprintf(f, "  \"knee\": null,\n");
+    }
+    std::fprintf(f, "  \"curve\": [");
+    for (size_t i = 0; i < steps.size(); ++i) {
+        const SearchStep& st = steps[i];
+        std::fprintf(f, "%s\n    {\"connections\": %d, \"throughput_rps\": %.3f, \"p50_us\": %.3f, "
+                        "\"p99_us\": %.3f, \"errors\": %llu, \"ok\": %s}",
+                     i ? "," : "", st.connections, st.rps, st.p50 / 1e3, st.p99 / 1e3,
+                     (unsigned long long)st.errors, st.ok ? "true" : "false");
+    }
+    std::fprintf(f, "\n  ]\n}\n");
+    bool ok = std::ferror(f) == 0;
+    std::fclose(f);
+    return ok;
+}
+
+// Подготовка к прогону: корпус, предел дескрипторов, проверка io_uring
+// и общая арена (тексты корпуса или выражения, сгенерированные заранее).
+// corpus должен жить дольше arena: арена ссылается на его память.
+bool prepare_run(Options& opt, Corpus& corpus, MessageArena& arena) {
+    if (!opt.corpus.empty()) {
+        if (!corpus.open(opt.corpus)) return false;
+        if (opt.replay_recorded && !corpus.has_timestamps()) {
+            std::cerr << opt.corpus << ": corpus has no recorded timestamps\n";
+            return false;
+        }
+    }
+    raise_fd_limit(rlim_t(opt.connections) + 64);
+    if (opt.uring && !Uring().init(8)) {
+        std::cerr << "io_uring is unavailable (" << strerror(errno) << "), using epoll\n";
+        opt.uring = false;
+    }
+
+    // A/B сравнивает серверы на одних и тех же выражениях, поэтому без
+    // корпуса выражения берутся из общей арены
+    if (!opt.ab_addr.empty() && opt.corpus.empty() && opt.arena == 0) opt.arena = AB_DEFAULT_ARENA;
+    if (!opt.corpus.empty()) arena.build_from_corpus(corpus, opt.shard_index, opt.shard_count);
+    else if (opt.arena > 0) arena.generate(opt.workload, opt.n, opt.arena, opt.seed);
+    return true;
+}
+
+// Распределённый прогон. Координатор (--workers) раздаёт исполнителям
+// (--join) аргументы своей командной строки и номер доли, запускает всех
+// в общий момент и сливает их итоги. Управляющий протокол — строки текста:
+//   координатор → исполнитель: CONFIG <номер> <всего> <число аргументов>,
+//     затем по аргументу в строке
+//   исполнитель → координатор: READY или ERROR <причина>
+//   координатор → исполнитель: START <момент старта по CLOCK_REALTIME, нс>
+//   исполнитель → координатор: RESULT <код> <elapsed_ns> <user_s> <sys_s>
+//     <max_rss_kb> <число секунд ряда> <число серверов --endpoints>, по три
+//     строки Stats::write на итоги и на каждый сервер, затем строки ряда
+// Момент старта задан по часам реального времени, поэтому на разных машинах
+// они должны быть синхронизированы (NTP, PTP).
+constexpr int COORDINATOR_JOIN_TIMEOUT_MS = 60000;     // ожидание подключения исполнителей
+constexpr uint64_t COORDINATOR_START_DELAY_NS = 500000000; // запас до общего старта
+
+uint64_t realtime_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+// Управляющее соединение: построчное чтение и запись через stdio
+class ControlLink {
+public:
+    explicit ControlLink(int fd) : in_(fdopen(dup(fd), "r")), out_(fdopen(fd, "w")) {}
+    ~ControlLink() {
+        if (in_) std::fclose(in_);
+        if (out_) std::fclose(out_);
+    }
+    ControlLink(const ControlLink&) = delete;
+    ControlLink& operator=(const ControlLink&) = delete;
+
+    FILE* out() { return out_; }
+
+    // Строка без перевода строки; false — соединение закрыто
+    bool read_line(std::string& line) {
+        char* buf = nullptr;
+        size_t cap = 0;
+        ssize_t n = in_ ? getline(&buf, &cap, in_) : -1;
+        if (n >= 0) line.assign(buf, n > 0 && buf[n - 1] == '\n' ? size_t(n - 1) : size_t(n));
+        std::free(buf);
+        return n >= 0;
+    }
+
+    bool send(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        va_list ap;
+        va_start(ap, fmt);
+        std::vfprintf(out_, fmt, ap);
+        va_end(ap);
+        return std::fflush(out_) == 0;
+    }
+
+private:
+    FILE* in_;
+    FILE* out_;
+};
+
+// Доля исполнителя index из count: соединения и темпы делятся поровну,
+// корпус — на непрерывные части, seed у каждого свой. Отчёты пишет координатор.
+void apply_shard(Options& opt, int index, int count) {
+    auto share = [&](long total) { return total / count + (index < total % count ? 1 : 0); };
+    opt.connections = int(share(opt.connections));
+    if (opt.churn_count != LONG_MAX) opt.churn_count = share(opt.churn_count);
+    opt.ramp_rate /= count;
+    opt.churn_rate /= count;
+    opt.seed += uint64_t(index) * 0x9e3779b97f4a7c15ull;
+    opt.shard_index = index;
+    opt.shard_count = count;
+    opt.quiet = true;
+    opt.report_json.clear();
+    opt.report_csv.clear();
+}
+
+// Аргументы для исполнителей: командная строка без опций координатора.
+// seed передаётся явно, чтобы все исполнители отсчитывали свой от общего.
+std::vector<std::string> worker_args(int argc, char* argv[], const Options& opt) {
+    std::vector<std::string> args;
+    if (!opt.seed_set) {
+        args.push_back("--seed");
+        args.push_back(std::to_string(opt.seed));
+    }
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string name = arg.compare(0, 2, "--") == 0 ? arg.substr(2, arg.find('=') - 2) : "";
+        if (name == "workers" || name == "spawn" || name == "control-port") {
+            if (arg.find('=') == std::string::npos) ++i;
+            continue;
+        }
+        args.push_back(arg);
+    }
+    return args;
+}
+
+int run_worker(const std::string& coordinator) {
+    size_t colon = coordinator.rfind(':');
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    if (colon == std::string::npos ||
+        inet_pton(AF_INET, coordinator.substr(0, colon).c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Invalid coordinator address " << coordinator << "\n";
+        return 1;
+    }
+    addr.sin_port = htons(uint16_t(std::atoi(coordinator.c_str() + colon + 1)));
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect to coordinator");
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+    ControlLink link(fd);
+
+    std::string line;
+    int index = 0, count = 0;
+    size_t nargs = 0;
+    if (!link.read_line(line) || std::sscanf(line.c_str(), "CONFIG %d %d %zu", &index, &count, &nargs) != 3) {
+        std::cerr << "Invalid configuration from the coordinator\n";
+        return 1;
+    }
+    std::vector<std::string> args{"client"};
+    for (size_t i = 0; i < nargs && link.read_line(line); ++i) args.push_back(line);
+    std::vector<char*> argv;
+    for (std::string& a : args) argv.push_back(&a[0]);
+
+    Options opt;
+    Corpus corpus;
+    MessageArena arena;
+    if (args.size() != nargs + 1 || !parse_options(int(argv.size()), argv.data(), opt)) {
+        link.send("ERROR invalid options\n");
+        return 1;
+    }
+    apply_shard(opt, index, count);
+    if (!prepare_run(opt, corpus, arena)) {
+        link.send("ERROR cannot prepare the run\n");
+        return 1;
+    }
+    link.send("READY\n");
+
+    unsigned long long start = 0;
+    if (!link.read_line(line) || std::sscanf(line.c_str(), "START %llu", &start) != 1) {
+        std::cerr << "The coordinator cancelled the run\n";
+        return 1;
+    }
+    timespec at{time_t(start / 1000000000ull), long(start % 1000000000ull)};
+    while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &at, nullptr) == EINTR) {}
+
+    bool use_arena = !opt.corpus.empty() || opt.arena > 0;
+    RunResult run;
+    run_clients(opt, use_arena ? &arena : nullptr, nullptr, false, run);
+    CpuUsage cpu = cpu_usage();
+    std::fprintf(link.out(), "RESULT %d %llu %.6f %.6f %ld %zu %zu\n", run.rc,
+                 (unsigned long long)run.elapsed, cpu.user_s, cpu.sys_s, cpu.max_rss_kb,
+                 run.series[0].size(), run.endpoints.size());
+    run.totals[0].write(link.out());
+    for (const Stats& es : run.endpoints) es.write(link.out());
+    for (const IntervalStats& iv : run.series[0]) iv.write(link.out());
+    return std::fflush(link.out()) == 0 ? run.rc : 1;
+}
+
+// Итоги из трёх строк Stats::write
+bool read_stats(ControlLink& link, Stats& stats) {
+    std::string counts, connect, request;
+    return link.read_line(counts) && link.read_line(connect) && link.read_line(request) &&
+           stats.read(counts, connect, request);
+}
+
+// Итоги одного исполнителя; итоги по серверам добавляются в endpoints.
+// false — исполнитель не прислал их целиком
+bool read_worker_result(ControlLink& link, Stats& stats, std::vector<Stats>& endpoints,
+                        std::map<uint64_t, IntervalStats>& series, uint64_t& elapsed,
+                        CpuUsage& cpu, int& rc) {
+    std::string line;
+    unsigned long long el = 0;
+    size_t n = 0, m = 0;
+    if (!link.read_line(line) ||
+        std::sscanf(line.c_str(), "RESULT %d %llu %lf %lf %ld %zu %zu", &rc, &el, &cpu.user_s,
+                    &cpu.sys_s, &cpu.max_rss_kb, &n, &m) != 7 ||
+        m != endpoints.size()) {
+        return false;
+    }
+    elapsed = el;
+    if (!read_stats(link, stats)) return false;
+    for (Stats& es : endpoints) {
+        if (!read_stats(link, es)) return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        IntervalStats iv;
+        if (!link.read_line(line) || !iv.read(line)) return false;
+        IntervalStats& slot = series[iv.second];
+        slot.second = iv.second;
+        slot.merge(iv);
+    }
+    return true;
+}
+
+int run_coordinator(const Options& opt, int argc, char* argv[]) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(uint16_t(opt.control_port));
+    socklen_t len = sizeof(addr);
+    if (lfd < 0 || bind(lfd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, opt.workers) < 0 ||
+        getsockname(lfd, (sockaddr*)&addr, &len) < 0) {
+        perror("coordinator control socket");
+        if (lfd >= 0) close(lfd);
+        return 1;
+    }
+    int port = ntohs(addr.sin_port);
+    std::printf("Coordinator: waiting for %d workers on port %d\n", opt.workers, port);
+    std::fflush(stdout);
+
+    // Локальные исполнители — копии этого же исполняемого файла
+    std::vector<pid_t> children;
+    std::string self = "127.0.0.1:" + std::to_string(port);
+    for (int k = 0; k < opt.spawn; ++k) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(lfd);
+            execl("/proc/self/exe", argv[0], "--join", self.c_str(), (char*)nullptr);
+            perror("execl");
+            _exit(127);
+        }
+        if (pid < 0) perror("fork");
+        else children.push_back(pid);
+    }
+
+    std::vector<std::unique_ptr<ControlLink>> links;
+    while (int(links.size()) < opt.workers) {
+        pollfd p{lfd, POLLIN, 0};
+        if (poll(&p, 1, COORDINATOR_JOIN_TIMEOUT_MS) <= 0) break;
+        int fd = accept(lfd, nullptr, nullptr);
+        if (fd >= 0) links.emplace_back(new ControlLink(fd));
+    }
+    close(lfd);
+    bool ok = int(links.size()) == opt.workers;
+    if (!ok) std::cerr << "Only " << links.size() << " of " << opt.workers << " workers joined\n";
+
+    std::vector<std::string> args = worker_args(argc, argv, opt);
+    for (size_t i = 0; ok && i < links.size(); ++i) {
+        ControlLink& l = *links[i];
+        std::fprintf(l.out(), "CONFIG %zu %zu %zu\n", i, links.size(), args.size());
+        for (const std::string& a : args) std::fprintf(l.out(), "%s\n", a.c_str());
+        std::fflush(l.out());
+    }
+    std::string line;
+    for (size_t i = 0; ok && i < links.size(); ++i) {
+        if (!links[i]->read_line(line) || line != "READY") {
+            std::cerr << "Worker " << i << ": " << (line.empty() ? "disconnected" : line) << "\n";
+            ok = false;
+        }
+    }
+
+    Stats total;
+    std::vector<Stats> endpoints;
+    if (!opt.replicas.empty()) endpoints = std::vector<Stats>(server_list(opt).size());
+    std::map<uint64_t, IntervalStats> merged;
+    CpuUsage cpu;
+    uint64_t elapsed = 0;
+    int rc = ok ? 0 : 1;
+    if (ok) {
+        // Общий момент старта с запасом на доставку команды всем исполнителям
+        uint64_t start = realtime_ns() + COORDINATOR_START_DELAY_NS;
+        for (auto& l : links) l->send("START %llu\n", (unsigned long long)start);
+        for (size_t i = 0; i < links.size(); ++i) {
+            Stats ws;
+            CpuUsage wc;
+            uint64_t we = 0;
+            int wrc = 0;
+            if (!read_worker_result(*links[i], ws, endpoints, merged, we, wc, wrc)) {
+                std::cerr << "Worker " << i << ": no result\n";
+                rc = 1;
+                continue;
+            }
+            const Histogram& h = ws.request_latency;
+            std::printf("Worker %zu: replies=%llu errors=%llu p50=%.1fus p99=%.1fus cpu=%.3fs\n", i,
+                        (unsigned long long)ws.replies(),
+                        (unsigned long long)(ws.connect_errors.get() + ws.io_errors.get() +
+                                             ws.timeouts.get() + ws.resets.get()),
+                        h.percentile(50) / 1e3, h.percentile(99) / 1e3, wc.user_s + wc.sys_s);
+            total.merge(ws);
+            elapsed = std::max(elapsed, we);
+            cpu.user_s += wc.user_s;
+            cpu.sys_s += wc.sys_s;
+            cpu.max_rss_kb = std::max(cpu.max_rss_kb, wc.max_rss_kb);
+            if (wrc != 0) rc = wrc;
+        }
+    }
+    size_t reported = links.size();
+    links.clear();
+    for (pid_t pid : children) waitpid(pid, nullptr, 0);
+    if (!ok) return 1;
+
+    std::vector<IntervalStats> series;
+    for (auto& kv : merged) series.push_back(kv.second);
+    print_summary(total, elapsed, reported > 1);
+    if (no_replies(total)) rc = 1;
+    if (!endpoints.empty()) print_endpoints(opt, endpoints, elapsed);
+    std::printf("Workers CPU: user=%.3fs sys=%.3fs max_rss=%ldKB\n",
+                cpu.user_s, cpu.sys_s, cpu.max_rss_kb);
+    if (!opt.report_json.empty() &&
+        !write_json_report(opt.report_json, opt, total, series, elapsed, cpu, {}, nullptr, nullptr,
+                           endpoints.empty() ? nullptr : &endpoints)) {
+        rc = 1;
+    }
+    if (!opt.report_csv.empty() && !write_csv_report(opt.report_csv, total, series, elapsed, cpu)) {
+        rc = 1;
+    }
+    return rc;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!opt.make_corpus.empty()) return make_corpus(opt);
+
+    if (!opt.join.empty()) return run_worker(opt.join);
+    if (opt.workers > 0) return run_coordinator(opt, argc, argv);
+
+    Corpus corpus;
+    MessageArena arena;
+    if (!prepare_run(opt, corpus, arena)) return 1;
+    bool recording = !opt.record_corpus.empty();
+    std::vector<CorpusWriter> recorders(opt.threads);
+    bool ab = !opt.ab_addr.empty();
+    bool use_arena = !opt.corpus.empty() || opt.arena > 0;
+
+    if (opt.slo_p99_ns > 0) {
+        std::vector<SearchStep> steps;
+        bool found = run_search(opt, use_arena ? &arena : nullptr, steps);
+        print_search(opt, steps);
+        if (!opt.report_json.empty() && !write_search_report(opt.report_json, opt, steps)) return 1;
+        return found ? 0 : 1;
+    }
+
+    // «Плохие» соединения подключаются до старта основной нагрузки
+    std::unique_ptr<Adversary> adversary;
+    std::thread adversary_thread;
+    if (!opt.adversaries.empty()) {
+        adversary.reset(new Adversary(opt));
+        adversary_thread = std::thread([&] { adversary->run(); });
+        uint64_t deadline = now_ns() + 5000000000ull;
+        while (!adversary->ready() && now_ns() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        // Даём неблокирующим connect() завершиться
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    RunResult run;
+    run_clients(opt, use_arena ? &arena : nullptr, recording ? &recorders : nullptr, opt.quiet, run);
+    std::vector<AdversaryStats> adv;
+    if (adversary) {
+        adversary->stop();
+        adversary_thread.join();
+        adv = adversary->stats();
+    }
+
+    // Итоги по серверам; отчёты в файлы относятся к A, сравнение — в JSON
+    const Stats* totals = run.totals;
+    const std::vector<IntervalStats>* all_series = run.series;
+    uint64_t elapsed = run.elapsed;
+    int rc = run.rc;
+    const BurstStats& burst = run.burst;
+    const Stats& total = totals[0];
+    const std::vector<IntervalStats>& series = all_series[0];
+    if (ab) {
+        std::printf("=== A: %s:%d ===\n", opt.server_addr.c_str(), opt.server_port);
+        std::fflush(stdout);
+    }
+    print_summary(total, elapsed);
+    if (no_replies(total)) rc = 1;
+    if (!run.endpoints.empty()) print_endpoints(opt, run.endpoints, elapsed);
+    AbComparison cmp;
+    if (ab) {
+        std::printf("=== B: %s:%d ===\n", opt.ab_addr.c_str(), opt.ab_port);
+        print_summary(totals[1], elapsed);
+        if (no_replies(totals[1])) rc = 1;
+        cmp = compare_ab(totals, all_series, elapsed);
+        print_ab(opt, cmp, totals);
+        if (cmp.comparable && !cmp.identical) rc = 1;
+    }
+    print_adversaries(opt, adv);
+    if (opt.burst) print_burst(burst);
+
+    CpuUsage cpu = cpu_usage();
+    std::printf("Client CPU:  user=%.3fs sys=%.3fs max_rss=%ldKB\n",
+                cpu.user_s, cpu.sys_s, cpu.max_rss_kb);
+    if (!opt.report_json.empty() &&
+        !write_json_report(opt.report_json, opt, total, series, elapsed, cpu, adv,
+                           ab ? &cmp : nullptr, opt.burst ? &burst : nullptr,
+                           run.endpoints.empty() ? nullptr : &run.endpoints)) {
+        rc = 1;
+    }
+    if (!opt.report_csv.empty() &&
+        !write_csv_report(opt.report_csv, total, series, elapsed, cpu)) {
+        rc = 1;
+    }
+
+    // Записи всех потоков сливаются в один корпус, упорядоченный по времени отправки
+    CorpusWriter recorder;
+    for (const CorpusWriter& w : recorders) recorder.merge(w);
+    if (recording && !recorder.write(opt.record_corpus, opt.seed, true)) rc = 1;
+    return rc;
 }
@@ -0,0 +1,519 @@
+// TCP Server Performance Fuzzer (fuzz.cpp)
+// Ищет входные данные, на которых сервер тратит аномально много инструкций
+// или памяти на байт: длинные цепочки операторов, огромные числа, потоки без
+// разделителей, множество крошечных выражений подряд. Код сервера подключается
+// целиком, его main отключён через TCP_SERVER_NO_MAIN.
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Выделения памяти считает перехват из сервера
+#ifndef ALLOC_TRACKING
+#define ALLOC_TRACKING
+#endif
+#define TCP_SERVER_NO_MAIN
+#include "tcp_server.cpp"
+
+constexpr size_t COVERAGE_MAP_SIZE = 1 << 16; // ячеек карты переходов
+constexpr size_t QUEUE_LIMIT = 4096;           // наибольший размер очереди входов
+constexpr int REPEATS = 5;                     // замеров времени, из которых берётся минимум
+constexpr size_t MAX_REPLY = 21;               // "-9223372036854775808 "
+constexpr size_t MAX_REPLY_PER_BYTE = 4;       // "ERR " на каждый пробел пустых выражений
+
+// Покрытие: сборка с -fsanitize-coverage=trace-pc вставляет вызов
+// __sanitizer_cov_trace_pc в каждый базовый блок. Переход между блоками
+// (как в AFL) хешируется в ячейку карты, число проходов — в корзину степени двойки
+uint8_t coverage_map[COVERAGE_MAP_SIZE];  // проходы за текущий вход
+uint8_t coverage_seen[COVERAGE_MAP_SIZE]; // корзины, встречавшиеся раньше
+uintptr_t coverage_prev = 0;
+bool coverage_on = false;                 // считается только код сервера
+
+extern "C" __attribute__((no_sanitize_coverage)) void __sanitizer_cov_trace_pc() {
+    if (!coverage_on) return;
+    uintptr_t pc = uintptr_t(__builtin_return_address(0));
+    size_t cell = (pc ^ coverage_prev) & (COVERAGE_MAP_SIZE - 1);
+    coverage_prev = pc >> 1;
+    if (coverage_map[cell] < 255) coverage_map[cell]++;
+}
+
+// Корзина числа проходов: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+uint8_t hit_bucket(uint8_t hits) {
+    if (hits <= 3) return uint8_t(1 << (hits - 1));
+    if (hits < 8) return 1 << 3;
+    if (hits < 16) return 1 << 4;
+    if (hits < 32) return 1 << 5;
+    if (hits < 128) return 1 << 6;
+    return 1 << 7;
+}
+
+// Переносит покрытие входа в общее и очищает карту; возвращает число новых корзин
+size_t merge_coverage(size_t& edges) {
+    size_t fresh = 0;
+    for (size_t i = 0; i < COVERAGE_MAP_SIZE; ++i) {
+        if (!coverage_map[i]) continue;
+        uint8_t b = hit_bucket(coverage_map[i]);
+        if (!coverage_seen[i]) edges++;
+        if (!(coverage_seen[i] & b)) {
+            coverage_seen[i] |= b;
+            fresh++;
+        }
+        coverage_map[i] = 0;
+    }
+    return fresh;
+}
+
+// Счётчик выполненных инструкций потока (perf_event). Где PMU недоступен
+// (виртуальные машины, perf_event_paranoid), вместо него — процессорное время
+class WorkCounter {
+public:
+    WorkCounter() {
+        perf_event_attr attr{};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~WorkCounter() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    bool exact() const { return fd_ >= 0; }
+    const char* unit() const { return fd_ >= 0 ? "insns" : "ns"; }
+
+    uint64_t read() const {
+        uint64_t v = 0;
+        if (fd_ >= 0 && ::read(fd_, &v, sizeof(v)) == sizeof(v)) return v;
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// Цели поиска: затраты на байт входа
+enum Objective { OBJ_WORK, OBJ_ALLOCS, OBJ_BYTES, OBJ_COUNT };
+
+const char* const OBJECTIVE_NAMES[OBJ_COUNT] = {"work", "allocs", "bytes"};
+
+struct Cost {
+    uint64_t value[OBJ_COUNT] = {}; // инструкции (или нс), выделения, выделенные байты
+    size_t requests = 0;            // разобранных выражений
+};
+
+// Прогоняет вход через обработку запросов так, как его получил бы сервер:
+// порциями по READ_CHUNK байт, со сбросом арены после каждой порции. Ответы
+// копятся в буфере отправки, как у клиента, который их не читает. Первый блок
+// арены и буферы соединения выделяются заранее, как у давно открытого
+// соединения: замер видит только выделения на пути запроса, а не рост буферов
+Cost run_input(const std::string& input, const WorkCounter& counter) {
+    Cost cost;
+    Connection c;
+    c.in_buf.reserve(input.size() + READ_CHUNK);
+    c.out_buf.reserve(input.size() * MAX_REPLY_PER_BYTE + MAX_REPLY);
+    BumpArena arena;
+    arena.allocate(1, 1);
+    arena.reset();
+    AllocCounters before = alloc_counters();
+    coverage_prev = 0;
+    coverage_on = true;
+    uint64_t start = counter.read();
+    for (size_t at = 0; at < input.size(); at += READ_CHUNK) {
+        c.in_buf.append(input, at, READ_CHUNK);
+        cost.requests += process_requests(c, arena, nullptr, -1, false);
+        arena.reset();
+    }
+    cost.value[OBJ_WORK] = counter.read() - start;
+    coverage_on = false;
+    AllocCounters after = alloc_counters();
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        cost.value[OBJ_ALLOCS] += after.count[s] - before.count[s];
+        cost.value[OBJ_BYTES] += after.bytes[s] - before.bytes[s];
+    }
+    return cost;
+}
+
+double per_byte(const Cost& cost, int obj, size_t len) {
+    return double(cost.value[obj]) / double(std::max<size_t>(len, 1));
+}
+
+// Время без счётчика инструкций зашумлено: вход перемеряется и берётся
+// минимум. Покрытие повторных прогонов не учитывается
+void remeasure_work(const std::string& input, Cost& cost, const WorkCounter& counter) {
+    for (int k = 1; k < REPEATS; ++k) {
+        cost.value[OBJ_WORK] = std::min(cost.value[OBJ_WORK], run_input(input, counter).value[OBJ_WORK]);
+    }
+    std::memset(coverage_map, 0, sizeof(coverage_map));
+}
+
+struct FuzzOptions {
+    uint64_t runs = 100000;       // сколько мутантов проверить; 0 — только прогнать корпус
+    double seconds = 0;           // ограничение по времени, 0 — без ограничения
+    size_t max_len = 4096;        // наибольшая длина входа
+    size_t min_len = 256;         // короче — не попадает в худшие: на коротких входах
+                                  // затраты на байт съедают постоянные расходы
+    size_t keep = 8;              // худших входов на цель
+    uint64_t seed = 0;
+    bool seed_set = false;
+    std::string corpus;           // каталог регрессионного корпуса
+    double limit[OBJ_COUNT] = {}; // допустимые затраты на байт для корпуса, 0 — не проверять
+};
+
+void fuzz_usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "Options:\n"
+              << "  --runs N          mutated inputs to try (default 100000); 0 only replays\n"
+              << "                    the corpus\n"
+              << "  --seconds S       stop after S seconds\n"
+              << "  --max-len BYTES   longest input to generate (default 4096)\n"
+              << "  --min-len BYTES   shortest input to rank among the worst (default 256)\n"
+              << "  --keep K          worst inputs kept per objective (default 8)\n"
+              << "  --seed N          mutation RNG seed (default: time-based)\n"
+              << "  --corpus DIR      seed the search with DIR/*.in and save the worst inputs\n"
+              << "                    there as <objective>-<rank>.in\n"
+              << "  --max-work X      fail (exit 1) if a corpus input costs more than X\n"
+              << "                    instructions (ns without a PMU) per byte\n"
+              << "  --max-allocs X    ... more than X allocations per byte\n"
+              << "  --max-bytes X     ... more than X allocated bytes per byte\n";
+}
+
+bool parse_fuzz_options(int argc, char* argv[], FuzzOptions& opt) {
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0) {
+                std::cerr << "Unexpected argument " << arg << "\n";
+                return false;
+            }
+            std::string name = arg.substr(2), value;
+            size_t eq = name.find('=');
+            if (eq != std::string::npos) {
+                value = name.substr(eq + 1);
+                name.erase(eq);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                std::cerr << "Missing value for --" << name << "\n";
+                return false;
+            }
+
+            if (name == "runs")            opt.runs = std::stoull(value);
+            else if (name == "seconds")    opt.seconds = std::stod(value);
+            else if (name == "max-len")    opt.max_len = std::stoull(value);
+            else if (name == "min-len")    opt.min_len = std::stoull(value);
+            else if (name == "keep")       opt.keep = std::stoull(value);
+            else if (name == "seed") {
+                opt.seed = std::stoull(value);
+                opt.seed_set = true;
+            }
+            else if (name == "corpus")     opt.corpus = value;
+            else if (name == "max-work")   opt.limit[OBJ_WORK] = std::stod(value);
+            else if (name == "max-allocs") opt.limit[OBJ_ALLOCS] = std::stod(value);
+            else if (name == "max-bytes")  opt.limit[OBJ_BYTES] = std::stod(value);
+            else {
+                std::cerr << "Unknown option --" << name << "\n";
+                return false;
+            }
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+    return opt.max_len >= 1 && opt.keep >= 1;
+}
+
+// Начальные входы: по одному на каждый известный класс тяжёлых данных
+std::vector<std::string> builtin_seeds() {
+    std::string chain, digits(1000, '9'), flood, tiny, spaces(512, ' ');
+    for (int i = 0; i < 200; ++i) chain += "1+2*3-4/5*";
+    chain += "1 ";
+    digits += " ";
+    for (int i = 0; i < 1000; ++i) flood += "1+";
+    for (int i = 0; i < 1000; ++i) tiny += "1 ";
+    return {"1+2*3 ", "7/0 ", chain, digits, flood, tiny, spaces};
+}
+
+// Фрагменты, которые мутации вставляют целиком
+const char* const DICTIONARY[] = {
+    "+", "-", "*", "/", " ", "0", "1", "9", "/0", "*9", "  ",
+    "9223372036854775807", "9223372036854775808", "18446744073709551615",
+};
+
+// Случайно изменяет вход: точечные правки, вставки из словаря, удаление,
+// копирование и размножение участков (из них растут длинные цепочки и потоки),
+// склейка с другим входом очереди
+void mutate(std::string& s, std::mt19937_64& rng, const std::vector<std::string>& queue,
+            size_t max_len) {
+    static const char ALPHABET[] = "0123456789+-*/ ";
+    auto pos = [&](size_t limit) { return limit ? size_t(rng() % limit) : 0; };
+    switch (rng() % 7) {
+        case 0:
+            if (!s.empty()) {
+                s[pos(s.size())] = rng() % 8 ? ALPHABET[rng() % (sizeof(ALPHABET) - 1)] : char(rng());
+            }
+            break;
+        case 1:
+            s.insert(pos(s.size() + 1), DICTIONARY[rng() % (sizeof(DICTIONARY) / sizeof(DICTIONARY[0]))]);
+            break;
+        case 2:
+            if (!s.empty()) {
+                size_t at = pos(s.size());
+                s.erase(at, 1 + pos(16));
+            }
+            break;
+        case 3:
+            if (!s.empty()) {
+                size_t at = pos(s.size());
+                std::string piece = s.substr(at, 1 + pos(64));
+                s.insert(pos(s.size() + 1), piece);
+            }
+            break;
+        case 4:
+            if (!s.empty()) {
+                size_t at = pos(s.size());
+                std::string piece = s.substr(at, 1 + pos(8)), run;
+                for (size_t k = 1 + pos(64); k > 0 && run.size() < max_len; --k) run += piece;
+                s.insert(at, run);
+            }
+            break;
+        case 5: {
+            const std::string& other = queue[pos(queue.size())];
+            s = s.substr(0, pos(s.size() + 1)) + other.substr(pos(other.size() + 1));
+            break;
+        }
+        default:
+            if (!s.empty()) {
+                size_t at = pos(s.size());
+                size_t len = std::min(s.size() - at, 1 + pos(256));
+                s.replace(at, len, len, ALPHABET[rng() % (sizeof(ALPHABET) - 1)]);
+            }
+            break;
+    }
+    if (s.size() > max_len) s.resize(max_len);
+}
+
+// Худшие входы по одной цели, по убыванию затрат на байт
+struct Worst {
+    double score;
+    std::string input;
+    Cost cost;
+};
+
+// Включает вход в список худших, если он хуже последнего; возвращает, попал ли
+bool rank_input(std::vector<Worst>& worst, const std::string& input, const Cost& cost, int obj,
+                const FuzzOptions& opt) {
+    if (input.size() < opt.min_len) return false;
+    double score = per_byte(cost, obj, input.size());
+    if (score <= 0 || (worst.size() >= opt.keep && score <= worst.back().score)) return false;
+    for (const Worst& w : worst) {
+        if (w.input == input) return false;
+    }
+    Worst entry{score, input, cost};
+    worst.insert(std::upper_bound(worst.begin(), worst.end(), entry,
+                                  [](const Worst& a, const Worst& b) { return a.score > b.score; }),
+                 entry);
+    if (worst.size() > opt.keep) worst.pop_back();
+    return true;
+}
+
+// Начало входа в печатном виде, с длиной повторов: "1+" x500
+std::string preview(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size() && out.size() < 60;) {
+        size_t run = 1;
+        while (i + run < s.size() && s[i + run] == s[i]) ++run;
+        unsigned char ch = s[i];
+        char buf[16];
+        if (ch == '\\' || ch == '"') std::snprintf(buf, sizeof(buf), "\\%c", ch);
+        else if (ch >= 0x20 && ch < 0x7f) std::snprintf(buf, sizeof(buf), "%c", ch);
+        else std::snprintf(buf, sizeof(buf), "\\x%02x", ch);
+        out += buf;
+        if (run > 3) {
+            out += "{" + std::to_string(run) + "}";
+            i += run;
+        } else {
+            ++i;
+        }
+    }
+    if (out.size() >= 60) out += "...";
+    return out;
+}
+
+// Загружает *.in из каталога корпуса, по имени файла
+std::vector<std::pair<std::string, std::string>> load_corpus(const std::string& dir) {
+    std::vector<std::pair<std::string, std::string>> files;
+    DIR* d = opendir(dir.c_str());
+    if (!d) return files;
+    while (dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() < 4 || name.compare(name.size() - 3, 3, ".in") != 0) continue;
+        std::ifstream in(dir + "/" + name, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (!data.empty()) files.emplace_back(name, data);
+    }
+    closedir(d);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// Имя вида <цель>-<место>.in, под которым save_corpus сохраняет худшие входы
+bool ranked_name(const std::string& name) {
+    for (const char* obj : OBJECTIVE_NAMES) {
+        size_t len = std::strlen(obj);
+        if (name.size() > len + 4 && name.compare(0, len, obj) == 0 && name[len] == '-' &&
+            name.compare(name.size() - 3, 3, ".in") == 0 &&
+            std::all_of(name.begin() + len + 1, name.end() - 3, [](char ch) { return ch >= '0' && ch <= '9'; })) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Сохраняет худшие входы как <цель>-<место>.in. Сохранённые прошлым поиском
+// удаляются, чтобы более короткий прогон не оставил устаревших входов; вход,
+// худший сразу по нескольким целям, сохраняется один раз. Прочие файлы
+// каталога (представители классов class-*) не трогаются
+bool save_corpus(const std::string& dir, const std::vector<Worst> (&worst)[OBJ_COUNT]) {
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        perror(("mkdir " + dir).c_str());
+        return false;
+    }
+    if (DIR* d = opendir(dir.c_str())) {
+        std::vector<std::string> stale;
+        while (dirent* e = readdir(d)) {
+            if (ranked_name(e->d_name)) stale.push_back(dir + "/" + e->d_name);
+        }
+        closedir(d);
+        for (const std::string& path : stale) {
+            if (unlink(path.c_str()) < 0) perror(("unlink " + path).c_str());
+        }
+    }
+    std::vector<const std::string*> saved;
+    for (int obj = 0; obj < OBJ_COUNT; ++obj) {
+        size_t place = 0;
+        for (const Worst& w : worst[obj]) {
+            if (std::any_of(saved.begin(), saved.end(), [&](const std::string* s) { return *s == w.input; })) {
+                continue;
+            }
+            saved.push_back(&w.input);
+            char name[64];
+            std::snprintf(name, sizeof(name), "/%s-%02zu.in", OBJECTIVE_NAMES[obj], ++place);
+            std::ofstream out(dir + name, std::ios::binary | std::ios::trunc);
+            out.write(w.input.data(), w.input.size());
+            if (!out) {
+                std::cerr << "Failed to write " << dir << name << "\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    FuzzOptions opt;
+    if (!parse_fuzz_options(argc, argv, opt)) {
+        fuzz_usage(argv[0]);
+        return 1;
+    }
+    if (!opt.seed_set) opt.seed = uint64_t(time(nullptr));
+    std::mt19937_64 rng(opt.seed);
+    WorkCounter counter;
+
+    std::vector<std::string> queue;
+    std::vector<Worst> worst[OBJ_COUNT];
+    size_t edges = 0;
+
+    // Корпус прогоняется первым: это и затравка поиска, и регрессионная проверка
+    int rc = 0;
+    auto corpus = load_corpus(opt.corpus);
+    for (const auto& [name, data] : corpus) {
+        Cost cost = run_input(data, counter);
+        merge_coverage(edges);
+        if (!counter.exact()) remeasure_work(data, cost, counter);
+        std::printf("%-18s len=%-6zu requests=%-6zu %s/B=%.1f allocs/B=%.4f bytes/B=%.2f\n",
+                    name.c_str(), data.size(), cost.requests, counter.unit(),
+                    per_byte(cost, OBJ_WORK, data.size()), per_byte(cost, OBJ_ALLOCS, data.size()),
+                    per_byte(cost, OBJ_BYTES, data.size()));
+        for (int obj = 0; obj < OBJ_COUNT; ++obj) {
+            if (opt.limit[obj] > 0 && per_byte(cost, obj, data.size()) > opt.limit[obj]) {
+                std::fprintf(stderr, "%s exceeds the %s limit: %.4f > %g per byte\n", name.c_str(),
+                             OBJECTIVE_NAMES[obj], per_byte(cost, obj, data.size()), opt.limit[obj]);
+                rc = 1;
+            }
+            rank_input(worst[obj], data, cost, obj, opt);
+        }
+        queue.push_back(data);
+    }
+    if (opt.runs == 0) return rc;
+
+    for (std::string& seed : builtin_seeds()) {
+        if (seed.size() > opt.max_len) seed.resize(opt.max_len);
+        Cost cost = run_input(seed, counter);
+        merge_coverage(edges);
+        for (int obj = 0; obj < OBJ_COUNT; ++obj) rank_input(worst[obj], seed, cost, obj, opt);
+        queue.push_back(seed);
+    }
+    if (edges == 0) {
+        std::cerr << "No coverage feedback: build with -fsanitize-coverage=trace-pc; "
+                     "the search is guided by cost only\n";
+    }
+    std::printf("Fuzzing: seed %llu, %s counted by %s, corpus %zu inputs\n",
+                (unsigned long long)opt.seed, counter.unit(),
+                counter.exact() ? "perf_event" : "CLOCK_THREAD_CPUTIME_ID", corpus.size());
+    std::fflush(stdout);
+
+    // Потомок остаётся в очереди, если открыл новое покрытие или оказался среди
+    // худших хотя бы по одной цели
+    timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    uint64_t run = 0;
+    for (; run < opt.runs; ++run) {
+        if (opt.seconds > 0 && (run & 255) == 0) {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9 >= opt.seconds) break;
+        }
+        std::string child = queue[rng() % queue.size()];
+        for (int m = 1 + int(rng() % 4); m > 0; --m) mutate(child, rng, queue, opt.max_len);
+        if (child.empty()) continue;
+
+        Cost cost = run_input(child, counter);
+        bool keep = merge_coverage(edges) > 0;
+        const std::vector<Worst>& top = worst[OBJ_WORK];
+        if (!counter.exact() && child.size() >= opt.min_len &&
+            (top.size() < opt.keep || per_byte(cost, OBJ_WORK, child.size()) > top.back().score)) {
+            remeasure_work(child, cost, counter);
+        }
+        for (int obj = 0; obj < OBJ_COUNT; ++obj) keep |= rank_input(worst[obj], child, cost, obj, opt);
+        if (!keep) continue;
+        if (queue.size() < QUEUE_LIMIT) queue.push_back(child);
+        else queue[rng() % queue.size()] = child;
+    }
+
+    std::printf("Runs: %llu, queue %zu, coverage %zu edges\n", (unsigned long long)run,
+                queue.size(), edges);
+    for (int obj = 0; obj < OBJ_COUNT; ++obj) {
+        std::printf("Worst by %s per byte:\n", OBJECTIVE_NAMES[obj]);
+        for (const Worst& w : worst[obj]) {
+            std::printf("  %12.4f  len=%-6zu requests=%-6zu \"%s\"\n", w.score, w.input.size(),
+                        w.cost.requests, preview(w.input).c_str());
+        }
+    }
+    if (!opt.corpus.empty() && !save_corpus(opt.corpus, worst)) return 1;
+    return rc;
+}
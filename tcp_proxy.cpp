@@ -0,0 +1,524 @@
+// TCP Latency Proxy (proxy.cpp)
+// Прокси между клиентом и сервером: вносит задержку, джиттер, ограничение
+// полосы и дробление на сегменты. Заменяет tc netem там, где нет прав root.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+constexpr int MAX_EVENTS = 1000;           // Максимальное количество событий для epoll
+constexpr size_t PIPE_INITIAL = 16 * 1024; // начальный размер буфера направления
+constexpr size_t READ_MIN = 4096;          // минимум свободного места перед чтением
+
+// Монотонное время в наносекундах
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+struct Options {
+    int listen_port = 0;
+    std::string upstream_addr;
+    int upstream_port = 0;
+    uint64_t delay_ns = 0;          // задержка в одну сторону
+    uint64_t jitter_ns = 0;         // разброс задержки: равномерно в [-jitter, +jitter]
+    double bytes_per_ns = 0;        // полоса каждого направления соединения, 0 — без ограничения
+    size_t segment = 0;             // наибольший размер сегмента, 0 — как прочитано
+    size_t buffer_limit = 4u << 20; // сколько байт направление держит, прежде чем перестать читать
+    uint64_t seed = 0;
+    bool seed_set = false;
+};
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog
+              << " [options] <listen_port> <upstream_addr> <upstream_port>\n"
+              << "Options (each applies to both directions of every connection):\n"
+              << "  --delay MS         one-way delay in milliseconds, fractions allowed (default 0)\n"
+              << "  --jitter MS        add a uniform random delay in [-MS, +MS]; byte order is\n"
+              << "                     preserved, so a late chunk also holds back the ones after it\n"
+              << "  --bandwidth MBIT   cap each direction at MBIT megabits per second\n"
+              << "  --segment BYTES    forward data in writes of at most BYTES, each delayed separately\n"
+              << "  --buffer KB        stop reading a side once KB kilobytes wait to be sent\n"
+              << "                     (default 4096)\n"
+              << "  --seed N           jitter RNG seed (default: time-based)\n";
+}
+
+bool parse_options(int argc, char* argv[], Options& opt) {
+    std::vector<std::string> positional;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+            std::string name = arg.substr(2), value;
+            size_t eq = name.find('=');
+            if (eq != std::string::npos) {
+                value = name.substr(eq + 1);
+                name.erase(eq);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                std::cerr << "Missing value for --" << name << "\n";
+                return false;
+            }
+
+            if (name == "delay")          opt.delay_ns = uint64_t(std::stod(value) * 1e6);
+            else if (name == "jitter")    opt.jitter_ns = uint64_t(std::stod(value) * 1e6);
+            else if (name == "bandwidth") opt.bytes_per_ns = std::stod(value) * 1e6 / 8 / 1e9;
+            else if (name == "segment")   opt.segment = std::stoul(value);
+            else if (name == "buffer")    opt.buffer_limit = std::stoul(value) * 1024;
+            else if (name == "seed") {
+                opt.seed = std::stoull(value);
+                opt.seed_set = true;
+            }
+            else {
+                std::cerr << "Unknown option --" << name << "\n";
+                return false;
+            }
+        }
+        if (positional.size() != 3) return false;
+        opt.listen_port = std::stoi(positional[0]);
+        opt.upstream_addr = positional[1];
+        opt.upstream_port = std::stoi(positional[2]);
+    } catch (const std::exception&) {
+        return false;
+    }
+    if (opt.bytes_per_ns < 0 || opt.buffer_limit == 0) return false;
+    if (!opt.seed_set) {
+        opt.seed = uint64_t(std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    }
+    return true;
+}
+
+// Граница порции данных и момент, когда её можно отправить дальше
+struct Mark {
+    uint64_t end; // позиция потока сразу за порцией
+    uint64_t due;
+};
+
+// Поток байт в одну сторону: прочитанное из одного сокета ждёт в буфере
+// своего момента отправки в другой. Позиции отсчитываются от начала потока.
+struct Pipe {
+    std::vector<char> buf;
+    size_t head = 0;            // неотправленные байты — buf[head, tail)
+    size_t tail = 0;
+    uint64_t base = 0;          // позиция потока, соответствующая buf[0]
+    std::deque<Mark> marks;     // порции в порядке отправки
+    uint64_t link_free = 0;     // когда освободится «канал» при ограничении полосы
+    uint64_t last_due = 0;      // порции уходят строго по порядку
+    bool eof = false;           // источник закрыл запись
+    bool shut = false;          // получателю передан FIN
+    bool stalled = false;       // чтение источника приостановлено: буфер полон
+    bool blocked = false;       // получатель не принимает данные, ждём EPOLLOUT
+    bool armed = false;         // в очереди таймеров есть запись для этого направления
+
+    size_t buffered() const { return tail - head; }
+};
+
+// Пара сокетов: fd[0] — клиент, fd[1] — сервер. pipe[d] читает fd[d] и пишет в fd[1 - d]
+struct Session {
+    int fd[2] = {-1, -1};
+    Pipe pipe[2];
+    bool connecting = false;
+    bool active = false;
+    uint32_t gen = 0;           // поколение слота: устаревшие таймеры пропускаются
+};
+
+volatile sig_atomic_t stop_requested = 0;
+
+void on_stop_signal(int) { stop_requested = 1; }
+
+class Proxy {
+public:
+    explicit Proxy(const Options& opt)
+        : opt_(opt), rng_(opt.seed),
+          jitter_(-int64_t(opt.jitter_ns), int64_t(opt.jitter_ns)) {}
+
+    bool init() {
+        std::memset(&upstream_, 0, sizeof(upstream_));
+        upstream_.sin_family = AF_INET;
+        upstream_.sin_port = htons(opt_.upstream_port);
+        if (inet_pton(AF_INET, opt_.upstream_addr.c_str(), &upstream_.sin_addr) != 1) {
+            std::cerr << "Invalid upstream address " << opt_.upstream_addr << "\n";
+            return false;
+        }
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (listen_fd_ < 0) { perror("socket"); return false; }
+        int one = 1;
+        setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(opt_.listen_port);
+        if (bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return false; }
+        if (listen(listen_fd_, SOMAXCONN) < 0) { perror("listen"); return false; }
+
+        epoll_fd_ = epoll_create1(0);
+        if (epoll_fd_ < 0) { perror("epoll_create1"); return false; }
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (timer_fd_ < 0) { perror("timerfd_create"); return false; }
+
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u64 = LISTEN_TAG;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+        ev.data.u64 = TIMER_TAG;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &ev);
+        return true;
+    }
+
+    void run() {
+        std::vector<epoll_event> events(MAX_EVENTS);
+        while (!stop_requested) {
+            int n = epoll_wait(epoll_fd_, events.data(), MAX_EVENTS, -1);
+            if (n < 0) {
+                if (errno == EINTR) continue; // Повторить при прерывании сигналом
+                perror("epoll_wait");
+                break;
+            }
+            for (int i = 0; i < n; ++i) {
+                uint64_t tag = events[i].data.u64;
+                if (tag == LISTEN_TAG) accept_all();
+                else if (tag == TIMER_TAG) run_timers();
+                else on_event(uint32_t(tag >> 1), int(tag & 1), events[i].events);
+            }
+        }
+    }
+
+    void print_summary() const {
+        std::printf("Sessions: %llu (upstream connect errors %llu)\n",
+                    (unsigned long long)sessions_total_, (unsigned long long)connect_errors_);
+        std::printf("Bytes:    client->server %llu, server->client %llu\n",
+                    (unsigned long long)bytes_[0], (unsigned long long)bytes_[1]);
+    }
+
+private:
+    static constexpr uint64_t LISTEN_TAG = ~0ull;
+    static constexpr uint64_t TIMER_TAG = ~0ull - 1;
+
+    struct Timer {
+        uint64_t due;
+        uint32_t slot;
+        uint32_t gen;
+        int dir;
+        bool operator>(const Timer& o) const { return due > o.due; }
+    };
+
+    void accept_all() {
+        while (true) {
+            int cfd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+            if (cfd < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) perror("accept");
+                if (errno == EINTR) continue;
+                break;
+            }
+            int ufd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (ufd < 0) {
+                perror("socket");
+                close(cfd);
+                continue;
+            }
+            // Прокси не должен добавлять к задержке алгоритм Нейгла
+            int one = 1;
+            setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            setsockopt(ufd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (connect(ufd, (sockaddr*)&upstream_, sizeof(upstream_)) < 0 && errno != EINPROGRESS) {
+                perror("connect");
+                ++connect_errors_;
+                close(ufd);
+                close(cfd);
+                continue;
+            }
+
+            uint32_t slot;
+            if (!free_.empty()) {
+                slot = free_.back();
+                free_.pop_back();
+            } else {
+                slot = uint32_t(sessions_.size());
+                sessions_.emplace_back();
+            }
+            Session& s = sessions_[slot];
+            s.fd[0] = cfd;
+            s.fd[1] = ufd;
+            s.connecting = true;
+            s.active = true;
+            ++sessions_total_;
+            for (int side = 0; side < 2; ++side) {
+                epoll_event ev{};
+                ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                ev.data.u64 = (uint64_t(slot) << 1) | uint64_t(side);
+                epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, s.fd[side], &ev);
+            }
+        }
+    }
+
+    void on_event(uint32_t slot, int side, uint32_t evs) {
+        Session& s = sessions_[slot];
+        if (!s.active) return;
+        uint64_t now = now_ns();
+
+        if (side == 1 && s.connecting) {
+            if (!(evs & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(s.fd[1], SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err != 0) {
+                std::cerr << "connect to upstream: " << strerror(err) << "\n";
+                ++connect_errors_;
+                close_session(slot);
+                return;
+            }
+            // Данные клиента, пришедшие до подключения, ждут в буфере
+            s.connecting = false;
+            if (!pump(slot, 0, now)) { close_session(slot); return; }
+        }
+        if (evs & EPOLLOUT) {
+            s.pipe[1 - side].blocked = false;
+            if (!pump(slot, 1 - side, now)) { close_session(slot); return; }
+        }
+        if (evs & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            if (!read_side(s, side, now) || !pump(slot, side, now)) { close_session(slot); return; }
+        }
+        if (s.pipe[0].shut && s.pipe[1].shut) close_session(slot);
+    }
+
+    // Читает источник направления d до EAGAIN или заполнения буфера;
+    // false — ошибка сокета, сессию нужно закрыть
+    bool read_side(Session& s, int d, uint64_t now) {
+        Pipe& p = s.pipe[d];
+        while (!p.eof) {
+            if (p.buffered() >= opt_.buffer_limit) {
+                p.stalled = true;
+                return true;
+            }
+            reserve(p);
+            ssize_t n = read(s.fd[d], p.buf.data() + p.tail, p.buf.size() - p.tail);
+            if (n > 0) {
+                add_marks(p, size_t(n), now);
+                bytes_[d] += uint64_t(n);
+            } else if (n == 0) {
+                p.eof = true;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            } else if (errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Освобождает место под чтение: сдвигает данные к началу или растит буфер
+    void reserve(Pipe& p) {
+        if (p.buf.size() - p.tail >= READ_MIN) return;
+        if (p.head > 0) {
+            std::memmove(p.buf.data(), p.buf.data() + p.head, p.buffered());
+            p.base += p.head;
+            p.tail -= p.head;
+            p.head = 0;
+            if (p.buf.size() - p.tail >= READ_MIN) return;
+        }
+        p.buf.resize(std::max(PIPE_INITIAL, p.buf.size() * 2));
+    }
+
+    // Назначает только что прочитанным n байтам моменты отправки
+    void add_marks(Pipe& p, size_t n, uint64_t now) {
+        size_t seg = opt_.segment > 0 ? opt_.segment : n;
+        uint64_t pos = p.base + p.tail;
+        for (size_t off = 0; off < n; off += seg) {
+            size_t len = std::min(seg, n - off);
+            uint64_t due = due_time(p, len, now);
+            // Без дробления соседние порции с одним моментом отправки сливаются
+            if (opt_.segment == 0 && !p.marks.empty() && p.marks.back().due == due) {
+                p.marks.back().end = pos + off + len;
+            } else {
+                p.marks.push_back(Mark{pos + off + len, due});
+            }
+        }
+        p.tail += n;
+    }
+
+    // Момент отправки порции len байт, прочитанной в now: сначала она
+    // «передаётся» по каналу с ограниченной полосой, затем задерживается
+    uint64_t due_time(Pipe& p, size_t len, uint64_t now) {
+        uint64_t t = now;
+        if (opt_.bytes_per_ns > 0) {
+            t = std::max(now, p.link_free) + uint64_t(len / opt_.bytes_per_ns);
+            p.link_free = t;
+        }
+        int64_t delay = int64_t(opt_.delay_ns) + (opt_.jitter_ns > 0 ? jitter_(rng_) : 0);
+        t += uint64_t(std::max<int64_t>(delay, 0));
+        t = std::max(t, p.last_due);
+        p.last_due = t;
+        return t;
+    }
+
+    // Отправляет созревшие порции направления d, возобновляет чтение
+    // источника, если буфер освободился, и планирует таймер на следующую
+    bool pump(uint32_t slot, int d, uint64_t now) {
+        Session& s = sessions_[slot];
+        Pipe& p = s.pipe[d];
+        if (!flush(s, d, now)) return false;
+        while (p.stalled && p.buffered() < opt_.buffer_limit) {
+            p.stalled = false;
+            if (!read_side(s, d, now) || !flush(s, d, now)) return false;
+        }
+        if (p.eof && p.marks.empty() && !p.shut && !s.connecting) {
+            shutdown(s.fd[1 - d], SHUT_WR);
+            p.shut = true;
+        }
+        schedule(slot, d);
+        return true;
+    }
+
+    bool flush(Session& s, int d, uint64_t now) {
+        Pipe& p = s.pipe[d];
+        if (s.connecting || p.blocked) return true;
+        while (!p.marks.empty() && p.marks.front().due <= now) {
+            // Без дробления все созревшие порции уходят одной записью
+            if (opt_.segment == 0) {
+                while (p.marks.size() > 1 && p.marks[1].due <= now) p.marks.pop_front();
+            }
+            size_t len = size_t(p.marks.front().end - (p.base + p.head));
+            ssize_t w = send(s.fd[1 - d], p.buf.data() + p.head, len, MSG_NOSIGNAL);
+            if (w < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    p.blocked = true;
+                    break;
+                }
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p.head += size_t(w);
+            if (size_t(w) < len) {
+                p.blocked = true; // буфер отправки полон, остаток — по EPOLLOUT
+                break;
+            }
+            p.marks.pop_front();
+        }
+        if (p.head == p.tail) {
+            p.base += p.head;
+            p.head = p.tail = 0;
+        }
+        return true;
+    }
+
+    void schedule(uint32_t slot, int d) {
+        Session& s = sessions_[slot];
+        Pipe& p = s.pipe[d];
+        if (p.armed || p.blocked || s.connecting || p.marks.empty()) return;
+        uint64_t due = p.marks.front().due;
+        timers_.push(Timer{due, slot, s.gen, d});
+        p.armed = true;
+        if (timer_at_ == 0 || due < timer_at_) arm_timer(due);
+    }
+
+    void arm_timer(uint64_t due) {
+        itimerspec its{};
+        its.it_value.tv_sec = time_t(due / 1000000000ull);
+        its.it_value.tv_nsec = long(due % 1000000000ull);
+        timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+        timer_at_ = due;
+    }
+
+    void run_timers() {
+        uint64_t expirations;
+        while (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {}
+        timer_at_ = 0;
+        uint64_t now = now_ns();
+        while (!timers_.empty() && timers_.top().due <= now) {
+            Timer t = timers_.top();
+            timers_.pop();
+            Session& s = sessions_[t.slot];
+            if (!s.active || s.gen != t.gen) continue;
+            s.pipe[t.dir].armed = false;
+            if (!pump(t.slot, t.dir, now)) close_session(t.slot);
+            else if (s.pipe[0].shut && s.pipe[1].shut) close_session(t.slot);
+        }
+        if (!timers_.empty()) arm_timer(timers_.top().due);
+    }
+
+    void close_session(uint32_t slot) {
+        Session& s = sessions_[slot];
+        for (int side = 0; side < 2; ++side) close(s.fd[side]);
+        // Буферы освобождаются целиком: простаивающий слот не держит память
+        uint32_t gen = s.gen + 1;
+        s = Session{};
+        s.gen = gen;
+        free_.push_back(slot);
+    }
+
+    Options opt_;
+    sockaddr_in upstream_{};
+    int listen_fd_ = -1;
+    int epoll_fd_ = -1;
+    int timer_fd_ = -1;
+    uint64_t timer_at_ = 0;  // на когда взведён timerfd, 0 — не взведён
+    std::vector<Session> sessions_;
+    std::vector<uint32_t> free_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    std::mt19937_64 rng_;
+    std::uniform_int_distribution<int64_t> jitter_;
+    uint64_t sessions_total_ = 0;
+    uint64_t connect_errors_ = 0;
+    uint64_t bytes_[2] = {0, 0};
+};
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Каждое подключение занимает два дескриптора: поднимаем мягкий предел до жёсткого
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) perror("setrlimit(RLIMIT_NOFILE)");
+    }
+
+    // SIGINT/SIGTERM прерывают epoll_wait, после чего выводится сводка
+    struct sigaction sa{};
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    Proxy proxy(opt);
+    if (!proxy.init()) return 1;
+    char bandwidth[32] = "unlimited", segment[32] = "as read";
+    if (opt.bytes_per_ns > 0) std::snprintf(bandwidth, sizeof(bandwidth), "%g Mbit/s", opt.bytes_per_ns * 8e3);
+    if (opt.segment > 0) std::snprintf(segment, sizeof(segment), "%zu B", opt.segment);
+    std::printf("Proxy listening on port %d -> %s:%d (delay %g ms, jitter %g ms, bandwidth %s, "
+                "segment %s)\n",
+                opt.listen_port, opt.upstream_addr.c_str(), opt.upstream_port,
+                opt.delay_ns / 1e6, opt.jitter_ns / 1e6, bandwidth, segment);
+    std::fflush(stdout);
+    proxy.run();
+    proxy.print_summary();
+    return 0;
+}
@@ -1,23 +1,41 @@
 // TCP Calculator Server (server.cpp)
 #include <arpa/inet.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/mempolicy.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
-#include <stack>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
 constexpr int MAX_EVENTS = 1000; // Максимальное количество событий для epoll
+constexpr size_t READ_CHUNK = 512; // Сколько байт читается из сокета за вызов read
 
 // Устанавливает неблокирующий режим для файлового дескриптора
 int set_nonblocking(int fd) {
@@ -26,6 +44,182 @@ int set_nonblocking(int fd) {
     return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
+// Этапы обработки запроса, по которым учитываются выделения памяти
+enum AllocStage {
+    STAGE_OTHER, // вне пути запроса: accept, служебные структуры
+    STAGE_READ,  // чтение сокета во входной буфер
+    STAGE_EVAL,  // разбор и вычисление выражения
+    STAGE_REPLY, // запись ответа в буфер отправки
+    STAGE_WRITE, // отправка ответа
+    STAGE_COUNT
+};
+
+const char* const ALLOC_STAGE_NAMES[STAGE_COUNT] = {"other", "read", "eval", "reply", "write"};
+
+// Первые запросы потока прогревают буферы и арену; бюджет проверяется после них
+constexpr uint64_t ALLOC_WARMUP_REQUESTS = 1000;
+
+struct AllocCounters {
+    uint64_t count[STAGE_COUNT] = {};
+    uint64_t bytes[STAGE_COUNT] = {};
+};
+
+// Учёт выделений включается при сборке с -DALLOC_TRACKING: malloc, calloc,
+// realloc и выровненные posix_memalign, aligned_alloc, memalign, valloc и
+// pvalloc перехватываются и считаются в счётчиках потока по текущему этапу.
+// operator new стандартной библиотеки, в том числе выровненный, выделяет через
+// них и тоже учитывается. Без флага перехвата нет, а смена этапа ничего не стоит
+#ifdef ALLOC_TRACKING
+constexpr bool alloc_tracking = true;
+
+thread_local AllocCounters t_alloc;
+thread_local int t_alloc_stage = STAGE_OTHER;
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t align, size_t size);
+void* __libc_valloc(size_t size);
+void* __libc_pvalloc(size_t size);
+
+void* malloc(size_t size) {
+    t_alloc.count[t_alloc_stage]++;
+    t_alloc.bytes[t_alloc_stage] += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size) {
+    t_alloc.count[t_alloc_stage]++;
+    t_alloc.bytes[t_alloc_stage] += n * size;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    t_alloc.count[t_alloc_stage]++;
+    t_alloc.bytes[t_alloc_stage] += size;
+    return __libc_realloc(ptr, size);
+}
+
+// У glibc нет __libc_posix_memalign и __libc_aligned_alloc: обе сводятся
+// к memalign, а posix_memalign сама проверяет выравнивание
+void* memalign(size_t align, size_t size) {
+    t_alloc.count[t_alloc_stage]++;
+    t_alloc.bytes[t_alloc_stage] += size;
+    return __libc_memalign(align, size);
+}
+
+void* aligned_alloc(size_t align, size_t size) {
+    return memalign(align, size);
+}
+
+int posix_memalign(void** out, size_t align, size_t size) {
+    if (align % sizeof(void*) != 0 || (align & (align - 1)) != 0) return EINVAL;
+    void* p = memalign(align, size);
+    if (!p) return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+void* valloc(size_t size) {
+    t_alloc.count[t_alloc_stage]++;
+    t_alloc.bytes[t_alloc_stage] += size;
+    return __libc_valloc(size);
+}
+
+void* pvalloc(size_t size) {
+    t_alloc.count[t_alloc_stage]++;
+    t_alloc.bytes[t_alloc_stage] += size;
+    return __libc_pvalloc(size);
+}
+}
+
+inline void alloc_stage(AllocStage stage) { t_alloc_stage = stage; }
+inline AllocCounters alloc_counters() { return t_alloc; }
+#else
+constexpr bool alloc_tracking = false;
+
+inline void alloc_stage(AllocStage) {}
+inline AllocCounters alloc_counters() { return {}; }
+#endif
+
+// Арена запросов рабочего потока: память выделяется сдвигом указателя и не
+// освобождается по отдельности, а вся сразу сбрасывается в конце итерации
+// epoll-цикла. До RETAINED_BLOCKS обычных блоков остаются за ареной и
+// переиспользуются, поэтому в установившемся режиме обработка запроса не
+// обращается к malloc. Блоки под отдельные длинные выражения и лишние обычные
+// блоки при сбросе освобождаются, чтобы один пик не держал память потока.
+class BumpArena {
+public:
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t RETAINED_BLOCKS = 16; // 1 МБ на поток
+
+    void* allocate(size_t size, size_t align) {
+        while (cur_ < blocks_.size()) {
+            Block& b = blocks_[cur_];
+            size_t at = (used_ + align - 1) & ~(align - 1);
+            if (at + size <= b.size) {
+                used_ = at + size;
+                return b.data.get() + at;
+            }
+            ++cur_;
+            used_ = 0;
+        }
+        // Блок больше обычного получает только выражение, которое в обычный не влезло
+        size_t block = std::max(BLOCK_SIZE, size + align);
+        blocks_.push_back(Block{std::unique_ptr<char[]>(new char[block]), block});
+        if (block > BLOCK_SIZE) large_++;
+        used_ = 0;
+        return allocate(size, align);
+    }
+
+    void reset() {
+        if (large_ > 0) {
+            blocks_.erase(std::remove_if(blocks_.begin(), blocks_.end(),
+                                         [](const Block& b) { return b.size > BLOCK_SIZE; }),
+                          blocks_.end());
+            large_ = 0;
+        }
+        if (blocks_.size() > RETAINED_BLOCKS) blocks_.resize(RETAINED_BLOCKS);
+        cur_ = 0;
+        used_ = 0;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Block> blocks_;
+    size_t cur_ = 0;   // текущий блок
+    size_t used_ = 0;  // занято в текущем блоке
+    size_t large_ = 0; // блоков больше BLOCK_SIZE до сброса
+};
+
+// Аллокатор для стандартных контейнеров поверх BumpArena; deallocate ничего
+// не делает, память возвращается сбросом арены
+template <class T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    explicit ArenaAllocator(BumpArena& arena) : arena(&arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& o) const { return arena == o.arena; }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>& o) const { return arena != o.arena; }
+
+    BumpArena* arena;
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
 // Возвращает приоритет оператора
 int precedence(char op) {
     if (op == '+' || op == '-') return 1;
@@ -33,110 +227,575 @@ int precedence(char op) {
     return 0;
 }
 
-// Применяет оператор op к значениям a и b
-long apply_op(long a, long b, char op) {
+// Применяет оператор op к значениям a и b. Сложение, вычитание и умножение
+// выполняются в беззнаковой арифметике: переполнение даёт результат по модулю
+// 2^64 (на нём строит ожидаемые ответы клиент), а не неопределённое поведение.
+// false — деление на ноль или неизвестный оператор
+bool apply_op(long a, long b, char op, long& result) {
+    unsigned long ua = (unsigned long)a, ub = (unsigned long)b;
     switch (op) {
-        case '+': return a + b;
-        case '-': return a - b;
-        case '*': return a * b;
+        case '+': result = long(ua + ub); return true;
+        case '-': result = long(ua - ub); return true;
+        case '*': result = long(ua * ub); return true;
         case '/':
-            if (b == 0) throw std::runtime_error("Division by zero");
-            return a / b;
+            if (b == 0) return false;
+            // LONG_MIN / -1 не помещается в long и роняет процесс по SIGFPE
+            result = b == -1 ? long(0UL - ua) : a / b;
+            return true;
     }
-    throw std::runtime_error("Unknown operator");
+    return false;
+}
+
+// Снимает верхний оператор и два операнда со стеков и кладёт результат;
+// false — не хватает операнда или оператор не применим
+bool reduce(ArenaVector<long>& values, ArenaVector<char>& ops) {
+    if (values.size() < 2) return false;
+    long b = values.back(); values.pop_back();
+    long a = values.back(); values.pop_back();
+    char top_op = ops.back(); ops.pop_back();
+    long r;
+    if (!apply_op(a, b, top_op, r)) return false;
+    values.push_back(r);
+    return true;
 }
 
-// Функция вычисления целочисленного выражения с учётом приоритета операций
-long evaluate(const std::string& s) {
-    std::stack<long> values;  // стек для чисел
-    std::stack<char> ops;     // стек для операторов
+// Функция вычисления целочисленного выражения с учётом приоритета операций.
+// Стеки выделяются в арене запросов. false — ошибка, на которую сервер отвечает
+// ERR: ошибки не бросают исключений, чтобы некорректный запрос не выделял память
+bool evaluate(std::string_view s, BumpArena& arena, long& result) {
+    ArenaVector<long> values{ArenaAllocator<long>(arena)};  // стек для чисел
+    ArenaVector<char> ops{ArenaAllocator<char>(arena)};     // стек для операторов
 
     for (size_t i = 0; i < s.size();) {
         if (std::isspace(static_cast<unsigned char>(s[i]))) {
             ++i;
         }
         else if (std::isdigit(static_cast<unsigned char>(s[i]))) {
-            // читаем целое число
-            long val = 0;
+            // читаем целое число; слишком длинное берётся по модулю 2^64
+            unsigned long val = 0;
             while (i < s.size() && std::isdigit(static_cast<unsigned char>(s[i]))) {
-                val = val * 10 + (s[i++] - '0');
+                val = val * 10 + (unsigned long)(s[i++] - '0');
             }
-            values.push(val);
+            values.push_back(long(val));
         }
         else {
             // текущий символ — оператор
             char op = s[i++];
             // пока на вершине стека ops есть оператор с приоритетом >= текущего
-            while (!ops.empty() && precedence(ops.top()) >= precedence(op)) {
-                long b = values.top(); values.pop();
-                long a = values.top(); values.pop();
-                char top_op = ops.top(); ops.pop();
-                values.push(apply_op(a, b, top_op));
+            while (!ops.empty() && precedence(ops.back()) >= precedence(op)) {
+                if (!reduce(values, ops)) return false;
             }
-            ops.push(op);
+            ops.push_back(op);
         }
     }
 
     // остающиеся операции
     while (!ops.empty()) {
-        long b = values.top(); values.pop();
-        long a = values.top(); values.pop();
-        char top_op = ops.top(); ops.pop();
-        values.push(apply_op(a, b, top_op));
+        if (!reduce(values, ops)) return false;
     }
 
-    if (values.empty()) throw std::runtime_error("Empty expression");
-    return values.top();
+    if (values.empty()) return false;
+    result = values.back();
+    return true;
 }
 
+// Дедупликация одинаковых выражений, которые вычисляются одновременно в разных
+// рабочих потоках: первый поток вычисляет, остальные паркуют соединение с
+// дубликатом и продолжают обслуживать прочие, а по готовности результата
+// вычислитель будит их через eventfd. Запись живёт только пока идёт вычисление,
+// готовые результаты не кешируются. Таблица разбита на шарды со своими
+// мьютексами; под ними выполняется только поиск и вставка, а хеширование,
+// сверка и копирование выражения — снаружи. Запись выделяет память (копия
+// выражения для сверки при совпадении хеша), поэтому дедупликация включается
+// только для длинных выражений
+class Singleflight {
+public:
+    // Идущее вычисление; expr не меняется после вставки в таблицу
+    struct Flight {
+        std::string expr;
+        std::mutex mu;            // защищает поля ниже
+        bool done = false;
+        bool ok = false;
+        long result = 0;
+        std::vector<int> waiters; // eventfd потоков с запаркованными дубликатами
+    };
+    using FlightPtr = std::shared_ptr<Flight>;
+
+    explicit Singleflight(size_t min_size) : min_size_(min_size) {}
+
+    size_t min_size() const { return min_size_; }
+
+    // Вычисляет expr или присоединяется к идущему вычислению. nullptr — результат
+    // уже в result/ok; иначе поток wake_fd будет разбужен, когда вычисление
+    // завершится, и заберёт результат через take()
+    FlightPtr evaluate(std::string_view expr, BumpArena& arena, int wake_fd, long& result, bool& ok) {
+        size_t hash = std::hash<std::string_view>{}(expr);
+        Shard& shard = shards_[hash % SHARDS];
+        FlightPtr other;
+        {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            auto it = shard.inflight.find(hash);
+            if (it != shard.inflight.end()) other = it->second;
+        }
+        FlightPtr own;
+        if (!other) {
+            own = std::make_shared<Flight>();
+            own->expr.assign(expr);
+            std::lock_guard<std::mutex> lock(shard.mu);
+            auto [it, inserted] = shard.inflight.try_emplace(hash, own);
+            if (!inserted) other = it->second; // другой поток успел раньше
+        }
+        if (other) {
+            // При совпадении хеша у разных выражений поток вычисляет сам
+            if (other->expr != expr) {
+                ok = ::evaluate(expr, arena, result);
+                return nullptr;
+            }
+            joined_.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(other->mu);
+            if (other->done) {
+                result = other->result;
+                ok = other->ok;
+                return nullptr;
+            }
+            if (std::find(other->waiters.begin(), other->waiters.end(), wake_fd) == other->waiters.end()) {
+                other->waiters.push_back(wake_fd);
+            }
+            return other;
+        }
+
+        led_.fetch_add(1, std::memory_order_relaxed);
+        ok = ::evaluate(expr, arena, result);
+        std::vector<int> waiters;
+        {
+            std::lock_guard<std::mutex> lock(own->mu);
+            own->result = result;
+            own->ok = ok;
+            own->done = true;
+            waiters.swap(own->waiters);
+        }
+        {
+            std::lock_guard<std::mutex> lock(shard.mu);
+            auto it = shard.inflight.find(hash);
+            if (it != shard.inflight.end() && it->second == own) shard.inflight.erase(it);
+        }
+        uint64_t one = 1;
+        for (int fd : waiters) {
+            if (write(fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+        }
+        return nullptr;
+    }
+
+    // Результат завершённого вычисления; false — ещё не готов
+    static bool take(Flight& flight, long& result, bool& ok) {
+        std::lock_guard<std::mutex> lock(flight.mu);
+        if (!flight.done) return false;
+        result = flight.result;
+        ok = flight.ok;
+        return true;
+    }
+
+    // Вычислено самостоятельно и получено от другого потока
+    uint64_t led() const { return led_.load(std::memory_order_relaxed); }
+    uint64_t joined() const { return joined_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t SHARDS = 64;
+
+    // Шард на своей кэш-линии, чтобы потоки не делили линии соседних мьютексов
+    struct alignas(64) Shard {
+        std::mutex mu;
+        std::unordered_map<size_t, FlightPtr> inflight;
+    };
+
+    size_t min_size_;
+    Shard shards_[SHARDS];
+    std::atomic<uint64_t> led_{0};
+    std::atomic<uint64_t> joined_{0};
+};
+
 // Структура для хранения буферов соединения
 struct Connection {
     std::string in_buf;  // Буфер входящих данных
     std::string out_buf; // Буфер исходящих данных
+    // Дубликат, ждущий результата другого потока: пока он не готов, следующие
+    // выражения соединения не обрабатываются, чтобы ответы шли по порядку
+    Singleflight::FlightPtr pending;
+    // Номер соединения в потоке: дескриптор закрытого соединения может достаться
+    // новому, и запись о парковке старого не должна разбудить новое
+    uint64_t gen = 0;
 };
 
-int main(int argc, char* argv[]) {
-    // Проверяем аргументы командной строки
-    if (argc != 2) {
-        std::cerr << "Usage: " << argv[0] << " <port>\n";
-        return 1;
+// Дописывает ответ в буфер отправки
+void append_reply(std::string& out, bool ok, long result) {
+    if (ok) {
+        char num[24];
+        char* end = std::to_chars(num, num + sizeof(num), result).ptr;
+        out.append(num, end - num);
+    } else {
+        out.append("ERR");
+    }
+    out.push_back(' ');
+}
+
+// Обрабатывает завершённые выражения во входном буфере (разделитель — пробел)
+// и дописывает ответы в буфер отправки; возвращает число выражений.
+// Выражение читается прямо из буфера, прочитанное удаляется одним erase.
+// flights — общая дедупликация рабочих потоков, nullptr — без неё; wake_fd —
+// eventfd потока, через который он узнаёт о готовности результата для
+// запаркованного соединения (c.pending)
+size_t process_requests(Connection& c, BumpArena& arena, Singleflight* flights, int wake_fd, bool log) {
+    if (c.pending) return 0;
+    size_t begin = 0, pos, done = 0;
+    while ((pos = c.in_buf.find(' ', begin)) != std::string::npos) {
+        std::string_view expr(c.in_buf.data() + begin, pos - begin);
+        begin = pos + 1;
+
+        // Ответ записывается сразу в буфер отправки
+        size_t reply_at = c.out_buf.size();
+        long res = 0;
+        bool ok = false;
+        alloc_stage(STAGE_EVAL);
+        if (flights && expr.size() >= flights->min_size()) {
+            c.pending = flights->evaluate(expr, arena, wake_fd, res, ok);
+            if (c.pending) break;
+        } else {
+            ok = evaluate(expr, arena, res);
+        }
+        alloc_stage(STAGE_REPLY);
+        append_reply(c.out_buf, ok, res);
+        done++;
+        if (log) {
+            std::cout << "Expr: '" << expr << "' -> "
+                      << std::string_view(c.out_buf).substr(reply_at) << std::endl;
+        }
     }
-    int port = std::stoi(argv[1]); // Порт для прослушивания
+    c.in_buf.erase(0, begin);
+    return done;
+}
+
+// Дописывает ответ запаркованного соединения, если результат готов; затем
+// соединение обрабатывает выражения дальше обычным порядком
+bool resume_request(Connection& c, bool log) {
+    long res = 0;
+    bool ok = false;
+    if (!Singleflight::take(*c.pending, res, ok)) return false;
+    size_t reply_at = c.out_buf.size();
+    append_reply(c.out_buf, ok, res);
+    if (log) {
+        std::cout << "Expr: '" << c.pending->expr << "' -> "
+                  << std::string_view(c.out_buf).substr(reply_at) << " (singleflight)" << std::endl;
+    }
+    c.pending.reset();
+    return true;
+}
+
+// Как рабочие потоки делят входящие соединения
+enum class AcceptMode {
+    ReusePort, // у каждого потока свой слушающий сокет с SO_REUSEPORT, ядро распределяет
+               // соединения хешем от адресов — поровну в среднем, но не по загрузке
+    Exclusive, // один слушающий сокет во всех epoll с EPOLLEXCLUSIVE: соединение
+               // достаётся одному из ждущих в epoll_wait, то есть свободному потоку
+};
 
-    // Создаем слушающий сокет
+// Размещение рабочих потоков по узлам NUMA
+enum class NumaMode {
+    Off,    // как решит планировщик
+    Local,  // поток закреплён за процессором узла, его память — на том же узле
+    Remote, // память — на соседнем узле: для замера выигрыша от локальности
+};
+
+struct ServerOptions {
+    int port = 0;
+    int workers = 1;                          // рабочих потоков, у каждого свой epoll
+    AcceptMode accept = AcceptMode::ReusePort;
+    NumaMode numa = NumaMode::Off;
+    size_t singleflight = 0;                  // наименьшая длина дедуплицируемого выражения, 0 — выкл.
+    bool quiet = false;                       // без построчного вывода
+    double alloc_budget = -1;                 // выделений на запрос после прогрева; <0 — не проверять
+};
+
+// Счётчики рабочего потока; читаются после его завершения
+struct WorkerStats {
+    uint64_t accepted = 0;
+    uint64_t requests = 0;
+    size_t active_peak = 0; // наибольшее число одновременно открытых соединений
+    double cpu_s = 0;       // процессорное время потока: неравномерность нагрузки
+    uint64_t alloc_requests = 0; // запросов после прогрева
+    AllocCounters alloc;         // выделения памяти после прогрева
+};
+
+void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options] <port>\n"
+              << "Options:\n"
+              << "  --workers N               worker threads, each with its own epoll (default 1)\n"
+              << "  --accept reuseport|exclusive\n"
+              << "                            reuseport: a listening socket per worker with\n"
+              << "                            SO_REUSEPORT (default); exclusive: one shared socket\n"
+              << "                            in every worker's epoll with EPOLLEXCLUSIVE\n"
+              << "  --numa off|local|remote   local: spread workers over NUMA nodes, pin each to a\n"
+              << "                            CPU and bind its memory to that node; remote: bind\n"
+              << "                            the memory to another node instead (to measure the\n"
+              << "                            locality gain); default off\n"
+              << "  --alloc-budget N          fail (exit 1) if a worker's request path makes more\n"
+              << "                            than N allocations per request after warm-up;\n"
+              << "                            needs a build with -DALLOC_TRACKING\n"
+              << "  --singleflight BYTES      when workers evaluate the same expression of at\n"
+              << "                            least BYTES at the same time, compute it once and\n"
+              << "                            hand the result to the others (default off)\n"
+              << "  --quiet                   do not log connections and expressions\n";
+}
+
+bool parse_options(int argc, char* argv[], ServerOptions& opt) {
+    std::vector<std::string> positional;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.compare(0, 2, "--") != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+            std::string name = arg.substr(2), value;
+            if (name == "quiet") {
+                opt.quiet = true;
+                continue;
+            }
+            size_t eq = name.find('=');
+            if (eq != std::string::npos) {
+                value = name.substr(eq + 1);
+                name.erase(eq);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                std::cerr << "Missing value for --" << name << "\n";
+                return false;
+            }
+
+            if (name == "workers") opt.workers = std::stoi(value);
+            else if (name == "accept") {
+                if (value == "reuseport")      opt.accept = AcceptMode::ReusePort;
+                else if (value == "exclusive") opt.accept = AcceptMode::Exclusive;
+                else {
+                    std::cerr << "Unknown accept mode " << value << "\n";
+                    return false;
+                }
+            }
+            else if (name == "numa") {
+                if (value == "off")         opt.numa = NumaMode::Off;
+                else if (value == "local")  opt.numa = NumaMode::Local;
+                else if (value == "remote") opt.numa = NumaMode::Remote;
+                else {
+                    std::cerr << "Unknown NUMA mode " << value << "\n";
+                    return false;
+                }
+            }
+            else if (name == "singleflight") opt.singleflight = std::stoull(value);
+            else if (name == "alloc-budget") {
+                if (!alloc_tracking) {
+                    std::cerr << "--alloc-budget needs a build with -DALLOC_TRACKING\n";
+                    return false;
+                }
+                opt.alloc_budget = std::stod(value);
+            }
+            else {
+                std::cerr << "Unknown option --" << name << "\n";
+                return false;
+            }
+        }
+        if (positional.size() != 1) return false;
+        opt.port = std::stoi(positional[0]); // Порт для прослушивания
+    } catch (const std::exception&) {
+        return false;
+    }
+    return opt.workers >= 1;
+}
+
+// Узел NUMA и его процессоры
+struct NumaNode {
+    int id = 0;
+    std::vector<int> cpus;
+};
+
+// Разбор списка процессоров вида 0-3,8,10-11
+std::vector<int> parse_cpulist(const std::string& list) {
+    std::vector<int> cpus;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int first, last;
+        int n = std::sscanf(item.c_str(), "%d-%d", &first, &last);
+        if (n < 1) continue;
+        if (n == 1) last = first;
+        for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Узлы NUMA с процессорами по сведениям /sys, по возрастанию номера;
+// пусто, если сведений нет
+std::vector<NumaNode> numa_nodes() {
+    std::vector<NumaNode> nodes;
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (!dir) return nodes;
+    while (dirent* entry = readdir(dir)) {
+        int id;
+        if (std::sscanf(entry->d_name, "node%d", &id) != 1) continue;
+        std::ifstream in(std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+        std::string list;
+        std::getline(in, list);
+        NumaNode node{id, parse_cpulist(list)};
+        if (!node.cpus.empty()) nodes.push_back(node); // узлы только с памятью пропускаем
+    }
+    closedir(dir);
+    std::sort(nodes.begin(), nodes.end(),
+              [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+    return nodes;
+}
+
+// Размещение рабочего потока (-1 — не задано)
+struct Placement {
+    int cpu = -1;      // процессор, за которым закреплён поток
+    int node = -1;     // узел этого процессора
+    int mem_node = -1; // узел, на котором выделяется память потока
+};
+
+// Потоки распределяются по узлам по очереди, внутри узла — по процессорам.
+// false — размещение невозможно
+bool plan_placement(const ServerOptions& opt, std::vector<Placement>& plan) {
+    plan.assign(opt.workers, Placement{});
+    if (opt.numa == NumaMode::Off) return true;
+    std::vector<NumaNode> nodes = numa_nodes();
+    if (nodes.empty()) {
+        std::cerr << "No NUMA topology in /sys/devices/system/node\n";
+        return false;
+    }
+    if (opt.numa == NumaMode::Remote && nodes.size() < 2) {
+        std::cerr << "--numa remote needs at least two NUMA nodes with CPUs\n";
+        return false;
+    }
+    for (int w = 0; w < opt.workers; ++w) {
+        const NumaNode& node = nodes[w % nodes.size()];
+        Placement& p = plan[w];
+        p.node = node.id;
+        p.cpu = node.cpus[(w / nodes.size()) % node.cpus.size()];
+        p.mem_node = opt.numa == NumaMode::Local ? node.id : nodes[(w + 1) % nodes.size()].id;
+    }
+    return true;
+}
+
+// Закрепляет текущий поток за процессором и привязывает его память к узлу.
+// Вызывается до первых выделений памяти потоком: буферы соединений, таблица
+// соединений и арена malloc этого потока окажутся на заданном узле
+void apply_placement(const Placement& p) {
+    if (p.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(p.cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) std::cerr << "pthread_setaffinity_np: " << strerror(err) << "\n";
+    }
+    if (p.mem_node >= 0) {
+        constexpr int BITS = 8 * sizeof(unsigned long);
+        unsigned long mask[1024 / BITS] = {};
+        mask[p.mem_node / BITS] |= 1ul << (p.mem_node % BITS);
+        // Ядро считает число узлов в маске на единицу меньше переданного
+        if (syscall(SYS_set_mempolicy, MPOL_BIND, mask, sizeof(mask) * 8 + 1) < 0) {
+            perror("set_mempolicy");
+        }
+    }
+}
+
+// Создаёт неблокирующий слушающий сокет на всех интерфейсах; -1 — ошибка
+int open_listener(int port, bool reuseport) {
     int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (listen_fd < 0) { perror("socket"); return 1; }
+    if (listen_fd < 0) { perror("socket"); return -1; }
     set_nonblocking(listen_fd); // Делаем сокет неблокирующим
 
     int opt = 1;
     // Повторное использование адреса
     setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Несколько сокетов на одном порту: ядро распределяет между ними соединения
+    if (reuseport && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(listen_fd);
+        return -1;
+    }
 
     sockaddr_in addr{};
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = INADDR_ANY;       // Принимаем на всех интерфейсах
     addr.sin_port = htons(port);             // Преобразуем порт в сетевой порядок
-    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) { perror("bind"); return 1; }
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(listen_fd);
+        return -1;
+    }
+    if (listen(listen_fd, SOMAXCONN) < 0) {
+        perror("listen");
+        close(listen_fd);
+        return -1;
+    }
+    return listen_fd;
+}
 
-    if (listen(listen_fd, SOMAXCONN) < 0) { perror("listen"); return 1; }
+// Цикл рабочего потока: принимает соединения с listen_fd и обслуживает их
+// до сигнала на stop_fd. При exclusive слушающий сокет общий для всех потоков.
+// wake_fd — eventfd потока для дедупликации (-1 без неё): по нему поток узнаёт,
+// что результат для запаркованных соединений готов
+void run_worker(int listen_fd, bool exclusive, int stop_fd, int wake_fd, const ServerOptions& sopt,
+                const Placement& placement, Singleflight* flights, WorkerStats& out) {
+    apply_placement(placement);
+    // Счётчики ведутся в памяти потока и копируются в out в конце: соседние
+    // WorkerStats делят кэш-линию и лежат на узле главного потока
+    WorkerStats stats;
+    BumpArena arena; // память запросов, сбрасывается после каждой пачки событий
+    AllocCounters alloc_base; // счётчики выделений на конец прогрева
+    uint64_t warm_requests = 0;
 
     // Создаем epoll-демон
     int epoll_fd = epoll_create1(0);
-    if (epoll_fd < 0) { perror("epoll_create1"); return 1; }
+    if (epoll_fd < 0) { perror("epoll_create1"); return; }
 
-    // Регистрируем слушающий дескриптор только на чтение
+    // Регистрируем слушающий дескриптор только на чтение. С EPOLLEXCLUSIVE
+    // о новом соединении узнаёт не каждый поток, а один из ждущих событий
     epoll_event ev{};
-    ev.events = EPOLLIN;
+    ev.events = EPOLLIN | (exclusive ? uint32_t(EPOLLEXCLUSIVE) : 0u);
     ev.data.fd = listen_fd;
     epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    // Сигнал остановки будит все потоки
+    ev.events = EPOLLIN;
+    ev.data.fd = stop_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+    if (wake_fd >= 0) {
+        ev.data.fd = wake_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+    }
 
     // Хранилище подключений и событий
     std::unordered_map<int, Connection> conns;
     std::vector<epoll_event> events(MAX_EVENTS);
+    // Соединения, ждущие результата другого потока: (дескриптор, номер соединения).
+    // Соединение попадает сюда один раз, когда паркуется, и уходит, когда
+    // дождалось результата или закрылось
+    std::vector<std::pair<int, uint64_t>> parked;
+    uint64_t next_gen = 0;
 
-    std::cout << "Server listening on port " << port << std::endl;
+    // Учитывает обработанные выражения соединения и включает EPOLLOUT для отправки
+    auto replied = [&](int fd, size_t done) {
+        if (done == 0) return;
+        stats.requests += done;
+        if (alloc_tracking && warm_requests == 0 && stats.requests >= ALLOC_WARMUP_REQUESTS) {
+            alloc_base = alloc_counters();
+            warm_requests = stats.requests;
+        }
+        epoll_event mod{};
+        mod.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        mod.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &mod);
+    };
 
-    while (true) {
+    bool stopping = false;
+    while (!stopping) {
         int n = epoll_wait(epoll_fd, events.data(), MAX_EVENTS, -1);
         if (n < 0 && errno == EINTR) continue; // Повторить при прерывании сигналом
 
@@ -144,9 +803,34 @@ int main(int argc, char* argv[]) {
             int fd  = events[i].data.fd;
             uint32_t evs = events[i].events;
 
-            if (fd == listen_fd) {
-                // Обработка новых подключений
-                while (true) {
+            if (fd == stop_fd) {
+                stopping = true;
+            }
+            else if (fd == wake_fd) {
+                // Готовы результаты для части запаркованных соединений. Записи
+                // закрытых соединений, в том числе чей дескриптор уже занят новым
+                // соединением, выпадают по несовпадению номера
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("read(eventfd)");
+                std::vector<std::pair<int, uint64_t>> waiting;
+                waiting.swap(parked);
+                for (auto [pfd, gen] : waiting) {
+                    auto it = conns.find(pfd);
+                    if (it == conns.end() || it->second.gen != gen || !it->second.pending) continue;
+                    Connection& pc = it->second;
+                    if (!resume_request(pc, !sopt.quiet)) {
+                        parked.emplace_back(pfd, gen);
+                        continue;
+                    }
+                    replied(pfd, 1 + process_requests(pc, arena, flights, wake_fd, !sopt.quiet));
+                    if (pc.pending) parked.emplace_back(pfd, gen);
+                }
+            }
+            else if (fd == listen_fd) {
+                // Обработка новых подключений. Общий сокет поток разбирает по одному
+                // соединению за пробуждение: сокет в epoll без EPOLLET, и пока поток
+                // обслуживает свои события, следующие соединения будят свободные потоки
+                for (int k = 0; !exclusive || k < 1; ++k) {
                     sockaddr_in client;
                     socklen_t len = sizeof(client);
                     int conn_fd = accept(listen_fd, (sockaddr*)&client, &len);
@@ -160,8 +844,11 @@ int main(int argc, char* argv[]) {
                     client_ev.events = EPOLLIN | EPOLLET;
                     client_ev.data.fd = conn_fd;
                     epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn_fd, &client_ev);
-                    conns[conn_fd] = Connection{};
-                    std::cout << "Accepted connection fd=" << conn_fd << std::endl;
+                    Connection& nc = conns[conn_fd] = Connection{};
+                    nc.gen = ++next_gen;
+                    stats.accepted++;
+                    stats.active_peak = std::max(stats.active_peak, conns.size());
+                    if (!sopt.quiet) std::cout << "Accepted connection fd=" << conn_fd << std::endl;
                 }
             }
             else {
@@ -169,7 +856,8 @@ int main(int argc, char* argv[]) {
 
                 // Чтение данных от клиента
                 if (evs & EPOLLIN) {
-                    char buf[512];
+                    alloc_stage(STAGE_READ);
+                    char buf[READ_CHUNK];
                     while (true) {
                         ssize_t count = read(fd, buf, sizeof(buf));
                         if (count > 0) {
@@ -185,33 +873,15 @@ int main(int argc, char* argv[]) {
                             goto next_event;
                         }
                     }
-                    // Обработка завершённых выражений (разделитель — пробел)
-                    size_t pos;
-                    while ((pos = c.in_buf.find(' ')) != std::string::npos) {
-                        std::string expr = c.in_buf.substr(0, pos);
-                        c.in_buf.erase(0, pos + 1);
-
-                        std::string reply;
-                        try {
-                            long res = evaluate(expr);
-                            reply = std::to_string(res);
-                        } catch (...) {
-                            reply = "ERR";
-                        }
-                        reply.push_back(' ');
-                        c.out_buf += reply;
-                        std::cout << "Expr: '" << expr << "' -> " << reply << std::endl;
-
-                        // Включаем EPOLLOUT для отправки
-                        epoll_event mod{};
-                        mod.events = EPOLLIN | EPOLLOUT | EPOLLET;
-                        mod.data.fd = fd;
-                        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &mod);
-                    }
+                    // Запаркованное соединение только копит входные данные
+                    bool was_parked = bool(c.pending);
+                    replied(fd, process_requests(c, arena, flights, wake_fd, !sopt.quiet));
+                    if (!was_parked && c.pending) parked.emplace_back(fd, c.gen);
                 }
 
                 // Отправка ответов клиенту
                 if (evs & EPOLLOUT) {
+                    alloc_stage(STAGE_WRITE);
                     while (!c.out_buf.empty()) {
                         ssize_t written = write(fd, c.out_buf.data(), c.out_buf.size());
                         if (written > 0) {
@@ -236,10 +906,150 @@ int main(int argc, char* argv[]) {
                 }
             }
 
-        next_event:;
+        next_event:
+            alloc_stage(STAGE_OTHER);
         }
+        arena.reset();
     }
 
-    close(listen_fd);
-    return 0;
+    for (auto& kv : conns) close(kv.first);
+    close(epoll_fd);
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    stats.cpu_s = ts.tv_sec + ts.tv_nsec / 1e9;
+    if (warm_requests > 0) {
+        AllocCounters now = alloc_counters();
+        for (int st = 0; st < STAGE_COUNT; ++st) {
+            stats.alloc.count[st] = now.count[st] - alloc_base.count[st];
+            stats.alloc.bytes[st] = now.bytes[st] - alloc_base.bytes[st];
+        }
+        stats.alloc_requests = stats.requests - warm_requests;
+    }
+    out = stats;
+}
+
+#ifndef TCP_SERVER_NO_MAIN
+int main(int argc, char* argv[]) {
+    // Проверяем аргументы командной строки
+    ServerOptions sopt;
+    if (!parse_options(argc, argv, sopt)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Каждое подключение занимает дескриптор: поднимаем мягкий предел до жёсткого
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) perror("setrlimit(RLIMIT_NOFILE)");
+    }
+
+    std::vector<Placement> placement;
+    if (!plan_placement(sopt, placement)) return 1;
+
+    // Слушающие сокеты: общий для EPOLLEXCLUSIVE или по одному на поток
+    bool exclusive = sopt.accept == AcceptMode::Exclusive;
+    std::vector<int> listeners;
+    for (int w = 0; w < (exclusive ? 1 : sopt.workers); ++w) {
+        int fd = open_listener(sopt.port, !exclusive);
+        if (fd < 0) return 1;
+        listeners.push_back(fd);
+    }
+
+    // SIGINT/SIGTERM принимает главный поток через sigwait, рабочие их не получают
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+    int stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (stop_fd < 0) { perror("eventfd"); return 1; }
+
+    std::cout << "Server listening on port " << sopt.port << " (" << sopt.workers << " worker"
+              << (sopt.workers > 1 ? "s" : "") << ", accept "
+              << (exclusive ? "exclusive" : "reuseport") << ")" << std::endl;
+
+    // Дедупликация: у каждого потока свой eventfd для пробуждения. Дескрипторы
+    // закрываются после завершения всех потоков, поэтому вычислитель никогда не
+    // пишет в закрытый или переиспользованный дескриптор
+    std::unique_ptr<Singleflight> flights;
+    std::vector<int> wake_fds(sopt.workers, -1);
+    if (sopt.singleflight > 0) {
+        flights = std::make_unique<Singleflight>(sopt.singleflight);
+        for (int& fd : wake_fds) {
+            fd = eventfd(0, EFD_NONBLOCK);
+            if (fd < 0) { perror("eventfd"); return 1; }
+        }
+    }
+
+    std::vector<WorkerStats> stats(sopt.workers);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < sopt.workers; ++w) {
+        int listen_fd = listeners[exclusive ? 0 : w];
+        workers.emplace_back(run_worker, listen_fd, exclusive, stop_fd, wake_fds[w], std::cref(sopt),
+                             std::cref(placement[w]), flights.get(), std::ref(stats[w]));
+    }
+
+    int sig = 0;
+    sigwait(&stop_signals, &sig);
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0) perror("write(eventfd)");
+    for (auto& t : workers) t.join();
+    for (int fd : listeners) close(fd);
+    close(stop_fd);
+    for (int fd : wake_fds) {
+        if (fd >= 0) close(fd);
+    }
+
+    // Распределение соединений и запросов по потокам
+    uint64_t accepted = 0, requests = 0;
+    for (const WorkerStats& st : stats) {
+        accepted += st.accepted;
+        requests += st.requests;
+    }
+    for (int w = 0; w < sopt.workers; ++w) {
+        const WorkerStats& st = stats[w];
+        const Placement& p = placement[w];
+        std::printf("Worker %d", w);
+        if (p.cpu >= 0) std::printf(" (cpu %d, node %d, memory node %d)", p.cpu, p.node, p.mem_node);
+        std::printf(": accepted=%llu (%.1f%%) requests=%llu (%.1f%%) active_peak=%zu cpu=%.3fs\n",
+                    (unsigned long long)st.accepted, accepted ? 100.0 * st.accepted / accepted : 0.0,
+                    (unsigned long long)st.requests, requests ? 100.0 * st.requests / requests : 0.0,
+                    st.active_peak, st.cpu_s);
+    }
+    if (flights) {
+        std::printf("Singleflight (>= %zu B): evaluated=%llu joined=%llu\n", sopt.singleflight,
+                    (unsigned long long)flights->led(), (unsigned long long)flights->joined());
+    }
+
+    // Выделения памяти на пути запроса после прогрева, по этапам
+    if (!alloc_tracking) return 0;
+    int rc = 0;
+    for (int w = 0; w < sopt.workers; ++w) {
+        const WorkerStats& st = stats[w];
+        if (st.alloc_requests == 0) {
+            std::printf("Worker %d allocations: fewer than %llu requests, not measured\n", w,
+                        (unsigned long long)ALLOC_WARMUP_REQUESTS);
+            continue;
+        }
+        uint64_t count = 0;
+        std::printf("Worker %d allocations per request:", w);
+        for (int s = STAGE_READ; s < STAGE_COUNT; ++s) {
+            count += st.alloc.count[s];
+            std::printf(" %s=%.4f (%.1f B)", ALLOC_STAGE_NAMES[s],
+                        double(st.alloc.count[s]) / st.alloc_requests,
+                        double(st.alloc.bytes[s]) / st.alloc_requests);
+        }
+        double per_request = double(count) / st.alloc_requests;
+        std::printf(" total=%.4f, other=%llu\n", per_request,
+                    (unsigned long long)st.alloc.count[STAGE_OTHER]);
+        if (sopt.alloc_budget >= 0 && per_request > sopt.alloc_budget) {
+            std::fflush(stdout);
+            std::fprintf(stderr, "Worker %d exceeds the allocation budget: %.4f > %g per request\n",
+                         w, per_request, sopt.alloc_budget);
+            rc = 1;
+        }
+    }
+    return rc;
 }
+#endif // TCP_SERVER_NO_MAIN